@@ -6,6 +6,7 @@
 #include "artdaq/Application/CommandableFragmentGenerator.hh"
 #include "artdaq-core-demo/Overlays/AsciiFragment.hh"
 #include "artdaq-core-demo/Overlays/FragmentType.hh"
+#include "artdaq-demo/Generators/WakeupEvent.hh"
 
 #include <random>
 #include <vector>
@@ -45,11 +46,13 @@ namespace demo
 		 */
 		bool getNext_(artdaq::FragmentPtrs& output) override;
 
-		// Explicitly declare that there is nothing special to be done
-		// by the start, stop, and stopNoMutex methods in this class
-		void start() override {} ///< No special start actions necessary
+		// start and resume rearm stopEvent_; stopNoMutex and pauseNoMutex
+		// signal it, so that getNext_ returns without sleeping out the throttle
+		void start() override { stopEvent_.clear(); } ///< Rearm stopEvent_
 		void stop() override {} ///< No special stop actions necessary
-		void stopNoMutex() override {} ///< No special stop actions necessary
+		void stopNoMutex() override { stopEvent_.signal(); } ///< Wake getNext_
+		void pauseNoMutex() override { stopEvent_.signal(); } ///< Wake getNext_
+		void resume() override { stopEvent_.clear(); } ///< Rearm stopEvent_
 
 		// FHiCL-configurable variables. Note that the C++ variable names
 		// are the FHiCL variable names with a "_" appended
@@ -59,6 +62,8 @@ namespace demo
 		// Members needed to generate the simulated data
 		std::string string1_; ///< The first string to generate. Alternates with string2_ in output data
 		std::string string2_; ///< The second string to generate. Alternates with string1_ in output data
+
+		WakeupEvent stopEvent_; ///< Signalled when the run is stopped or paused, to cut short the throttle sleep
 	};
 }
 
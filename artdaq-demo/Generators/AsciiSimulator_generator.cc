@@ -9,14 +9,13 @@
 #include "artdaq-core-demo/Overlays/FragmentType.hh"
 #include "fhiclcpp/ParameterSet.h"
 #include "artdaq-core/Utilities/SimpleLookupPolicy.hh"
+#include "artdaq/DAQdata/Globals.hh"
 
 #include <fstream>
 #include <iomanip>
 #include <iterator>
 #include <iostream>
 
-#include <unistd.h>
-
 namespace
 {
 	/**
@@ -65,33 +64,22 @@ bool demo::AsciiSimulator::getNext_(artdaq::FragmentPtrs& frags)
 	// JCF, 9/23/14
 
 	// If throttle_usecs_ is greater than zero (i.e., user requests a
-	// sleep interval before generating the pseudodata) then during that
-	// interval perform a periodic check to see whether a stop request
-	// has been received
-
-	// Values for throttle_usecs_ and throttle_usecs_check_ will have
-	// been tested for validity in constructor
+	// sleep interval before generating the pseudodata) then sleep on
+	// stopEvent_, so that a stop or pause request ends the sleep at once.
+	// stopNoMutex is called before should_stop() becomes true, so check both
 
 	if (throttle_usecs_ > 0)
 	{
-		size_t nchecks = throttle_usecs_ / 10000;
-
-		for (size_t i_c = 0; i_c < nchecks; ++i_c)
-		{
-			usleep(throttle_usecs_ / 10000);
-
-			if (should_stop())
-			{
-				return false;
-			}
-		}
+		stopEvent_.wait(std::chrono::microseconds(throttle_usecs_));
 	}
-	else
+
+	if (stopEvent_.signalled() || should_stop())
 	{
-		if (should_stop())
+		if (metricMan != nullptr && stopEvent_.signalled())
 		{
-			return false;
+			metricMan->sendMetric("Ascii Stop Latency", stopEvent_.sinceSignal().count() / 1e6, "ms", 1, artdaq::MetricMode::LastPoint);
 		}
+		return false;
 	}
 
 	// Set fragment's metadata
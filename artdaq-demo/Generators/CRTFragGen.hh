@@ -8,10 +8,15 @@
 #include "artdaq/Application/CommandableFragmentGenerator.hh"
 
 #include "CRTInterface/CRTInterface.hh"
+#include "CRTInterface/CRTdecode.hh"
+#include "CRTInterface/CRTTimeSorter.hh"
+#include "WakeupEvent.hh"
 
 #include <random>
 #include <vector>
+#include <map>
 #include <atomic>
+#include <chrono>
 
 namespace CRT
 {
@@ -35,7 +40,7 @@ namespace CRT
 
     // The start, stop and stopNoMutex methods are declared pure
     // virtual in CommandableFragmentGenerator and therefore MUST be
-    // overridden; note that stopNoMutex() doesn't do anything here
+    // overridden
 
     /**
      * \brief Perform start actions
@@ -48,16 +53,72 @@ namespace CRT
     void stop() override;
 
     /** \brief Override of pure virtual function in CommandableFragmentGenerator.
-    * stopNoMutex does not do anything in CRT::FragGen */
-    void stopNoMutex() override {}
+    * Wakes getNext_ if it is waiting for data. */
+    void stopNoMutex() override { stop_event_.signal(); }
+
+    /** \brief Wakes getNext_ if it is waiting for data */
+    void pauseNoMutex() override { stop_event_.signal(); }
+
+    /** \brief Get ready to take data again after a pause */
+    void resume() override { stop_event_.clear(); }
+
+    /**
+     * \brief Put one module packet into a new Fragment at the end of frags
+     */
+    void make_fragment_(std::list< std::unique_ptr<artdaq::Fragment> > & frags,
+                        const char * packet, std::size_t bytes);
+
+    /**
+     * \brief Put everything the time sorter holds into frags, in order
+     */
+    void flush_sorter_(std::list< std::unique_ptr<artdaq::Fragment> > & frags);
+
+    /**
+     * \brief Send accumulated metrics if at least metric_interval_s_ has
+     * passed since the last time, then start accumulating again.
+     */
+    void report_metrics_();
 
     std::unique_ptr<CRTInterface> hardware_interface_;
 
+    // Signalled by stopNoMutex() and pauseNoMutex(), so that getNext_
+    // doesn't sleep through a stop while waiting for data
+    demo::WakeupEvent stop_event_;
+
     // I don't know what kind of a time this is, except that it is a uint64_t
     artdaq::Fragment::timestamp_t timestamp_;
 
     // Written to by the hardware interface
     char* readout_buffer_;
+
+    // How often to send metrics, in seconds.  FHiCL: "metric_interval_s"
+    double metric_interval_s_;
+
+    std::chrono::steady_clock::time_point last_metric_time_;
+
+    // Accumulated since last_metric_time_
+    unsigned long metric_fragments_;
+    unsigned long metric_bytes_;
+
+    // Running totals as of last_metric_time_, to difference against
+    CRT::decoder_counters last_decoder_counters_;
+    unsigned long last_files_opened_;
+
+    // If "sort_latency_ms" is set and nonzero, module packets are held up to
+    // this long (in data time) so that they can be released in time order.
+    uint64_t sort_latency_ns_;
+    std::unique_ptr<CRT::TimeSorter> sorter_;
+    std::chrono::steady_clock::time_point last_input_time_;
+    uint64_t last_late_packets_;
+
+    // Fragment ID for each CRT module number, from "module_fragment_ids".
+    // Empty unless sharding by module.
+    std::vector<artdaq::Fragment::fragment_id_t> module_fragment_ids_;
+    artdaq::Fragment::fragment_id_t default_fragment_id_;
+
+    // Next sequence ID for each fragment ID when sharding by module
+    std::map<artdaq::Fragment::fragment_id_t,
+             artdaq::Fragment::sequence_id_t> next_sequence_ids_;
   };
 }
 
@@ -13,8 +13,9 @@
 #include <iomanip>
 #include <iterator>
 #include <iostream>
+#include <algorithm>
 
-#include <unistd.h>
+#include <poll.h>
 #include "cetlib_except/exception.h"
 
 CRT::FragGen::FragGen(fhicl::ParameterSet const& ps) :
@@ -22,12 +23,58 @@ CRT::FragGen::FragGen(fhicl::ParameterSet const& ps) :
   , hardware_interface_(new CRTInterface(ps))
   , timestamp_(0)
   , readout_buffer_(nullptr)
+  , metric_interval_s_(ps.get<double>("metric_interval_s", 1.0))
+  , last_metric_time_(std::chrono::steady_clock::now())
+  , metric_fragments_(0)
+  , metric_bytes_(0)
+  , last_decoder_counters_(CRT::counters)
+  , last_files_opened_(0)
+  , sort_latency_ns_(uint64_t(ps.get<double>("sort_latency_ms", 0)*1e6))
+  , last_late_packets_(0)
+  , default_fragment_id_(0)
 {
   // NOTE: Strawman scheme: start up Camillo's DAQ here.  Disadvantage:
   // files will pile up for an arbitrary amount of time. Alternatively,
   // could do it in start() if 5-10s startup time is acceptable there.
 
   hardware_interface_->AllocateReadoutBuffer(&readout_buffer_);
+
+  if(sort_latency_ns_ > 0)
+    sorter_.reset(new CRT::TimeSorter(sort_latency_ns_));
+
+  // Optionally send each CRT module's packets out under its own fragment
+  // ID so that modules can be routed to, and analyzed by, different
+  // consumers.  Given as a list of [module, fragment ID] pairs, where each
+  // fragment ID must also appear in "fragment_ids".  Modules not listed go
+  // to the first of "fragment_ids".
+  //
+  // Each shard numbers its fragments 1, 2, 3... on its own, so fragments
+  // with the same sequence ID from different shards have nothing to do
+  // with each other in time.  Don't build events across shards by
+  // sequence ID; give each shard its own consumer, or match by timestamp.
+  const auto module_map = ps.get<std::vector<std::vector<int>>>(
+    "module_fragment_ids", std::vector<std::vector<int>>());
+  if(!module_map.empty()){
+    const auto ids = fragmentIDs();
+    if(ids.empty())
+      throw cet::exception("CRTFragGen") << "module_fragment_ids given, "
+        "but no fragment_ids to map modules to";
+
+    // Module numbers are seven bits
+    default_fragment_id_ = ids[0];
+    module_fragment_ids_.assign(128, default_fragment_id_);
+    for(const auto & pair : module_map){
+      if(pair.size() != 2 || pair[0] < 0 ||
+         pair[0] >= int(module_fragment_ids_.size()))
+        throw cet::exception("CRTFragGen") << "module_fragment_ids entries "
+          "must be [module, fragment ID] with module 0-127";
+      if(std::find(ids.begin(), ids.end(), pair[1]) == ids.end())
+        throw cet::exception("CRTFragGen") << "Fragment ID " << pair[1]
+          << " for CRT module " << pair[0] << " is not in fragment_ids";
+      module_fragment_ids_[pair[0]] = pair[1];
+    }
+    for(const auto id : ids) next_sequence_ids_[id] = 1;
+  }
 }
 
 CRT::FragGen::~FragGen()
@@ -45,42 +92,120 @@ CRT::FragGen::~FragGen()
 bool CRT::FragGen::getNext_(
   std::list< std::unique_ptr<artdaq::Fragment> > & frags)
 {
-  if(should_stop()) return false;
+  // stopNoMutex() is called before should_stop() becomes true
+  if(should_stop() || stop_event_.signalled()){
+    if(metricMan != nullptr && stop_event_.signalled())
+      metricMan->sendMetric("CRT Stop Latency",
+          stop_event_.sinceSignal().count()/1e6, "ms", 1,
+          artdaq::MetricMode::LastPoint);
+    flush_sorter_(frags);
+    return false;
+  }
 
   std::size_t bytes_read = 0;
   hardware_interface_->FillBuffer(readout_buffer_, &bytes_read);
 
-  if(bytes_read == 0){
-    // Pause for a little bit if we didn't get anything to keep load down.
-    usleep(1000);
-    return true; // this means "keep taking data"
-  }
-
   assert(sizeof timestamp_ == 8);
 
   // A module packet must at least have the magic number (1B), hit count
   // (1B), module number (2B) and timestamps (8B).
   const std::size_t minsize = 4 + sizeof(timestamp_);
-  if(bytes_read < 4 + sizeof(timestamp_)){
+  if(bytes_read != 0 && bytes_read < minsize){
     fprintf(stderr, "Bad result with only %lu < %lu bytes from "
             "CRTInterface::FillBuffer.\n", bytes_read, minsize);
     return false; // means "stop taking data"
   }
 
+  if(!sorter_){
+    if(bytes_read != 0) make_fragment_(frags, readout_buffer_, bytes_read);
+  }
+  else{
+    const auto now = std::chrono::steady_clock::now();
+    if(bytes_read != 0){
+      sorter_->push(readout_buffer_, bytes_read);
+      last_input_time_ = now;
+    }
+
+    // If nothing has come in for longer than the latency budget, we're
+    // probably between files or the upstream DAQ has stopped.  Don't sit
+    // on what we have; anything arriving later would be late anyway.
+    const bool quiet = bytes_read == 0 &&
+      now - last_input_time_ > std::chrono::nanoseconds(sort_latency_ns_);
+
+    for(const std::vector<char> * packet; (packet = sorter_->ready(quiet));
+        sorter_->pop())
+      make_fragment_(frags, packet->data(), packet->size());
+  }
+
+  // Still report if we got nothing, so that rates drop to zero when data
+  // stops coming.
+  report_metrics_();
+
+  // If we didn't get anything, wait for the input file to change, or
+  // whatever else the hardware interface says, to keep load down.  A stop
+  // or pause cuts this short.  If the sorter is holding packets, come back
+  // in time to let them go once input has been quiet long enough.
+  if(bytes_read == 0 && frags.empty()){
+    int timeout_ms = 0;
+    const int fd = hardware_interface_->IdleWait(&timeout_ms);
+    if(sorter_ && sorter_->size() > 0)
+      timeout_ms = std::min(timeout_ms,
+                            std::max(1, int(sort_latency_ns_/1000000)));
+    if(timeout_ms > 0)
+      stop_event_.waitFor(fd, POLLIN, std::chrono::milliseconds(timeout_ms));
+  }
+
+  // Once stopNoMutex() has been called, getNext_ is not normally called
+  // again, and the checkpoint will be past everything decoded so far.  So
+  // what the sorter holds has to go out now, or never.
+  if(stop_event_.signalled()) flush_sorter_(frags);
+
+  return true; // this means "keep taking data"
+}
+
+void CRT::FragGen::flush_sorter_(
+  std::list< std::unique_ptr<artdaq::Fragment> > & frags)
+{
+  if(!sorter_) return;
+  for(const std::vector<char> * packet; (packet = sorter_->ready(true));
+      sorter_->pop())
+    make_fragment_(frags, packet->data(), packet->size());
+}
+
+void CRT::FragGen::make_fragment_(
+  std::list< std::unique_ptr<artdaq::Fragment> > & frags,
+  const char * const packet, const std::size_t bytes)
+{
   // NOTE: would like if this timestamp ended up being the full 64-bit
   // 50MHz clock by the time it got here, possibly via some repair
   // scheme inside FillBuffer that uses a side channel to get the
   // correspondence between Unix times and 50MHz times.
 
   // The Unix time stamp concatenated with the 50MHz counter
-  memcpy(&timestamp_, readout_buffer_ + 4, sizeof(timestamp_));
+  memcpy(&timestamp_, packet + 4, sizeof(timestamp_));
+
+  // If sharding by module, each fragment ID has its own sequence of
+  // sequence IDs so that every shard's stream is contiguous.  The same
+  // sequence ID in two shards does not mean the same time.
+  artdaq::Fragment::sequence_id_t seqid = ev_counter();
+  artdaq::Fragment::fragment_id_t fragid;
+  if(module_fragment_ids_.empty()){
+    fragid = fragment_id(); // from base CommandableFragmentGenerator
+  }
+  else{
+    uint16_t module;
+    memcpy(&module, packet + 2, sizeof module);
+    fragid = module < module_fragment_ids_.size()?
+      module_fragment_ids_[module]: default_fragment_id_;
+    seqid = next_sequence_ids_[fragid]++;
+  }
 
   std::unique_ptr<artdaq::Fragment> fragptr(
     // See $ARTDAQ_DIR/Data/Fragment.hh
     artdaq::Fragment::FragmentBytes(
-      bytes_read,
-      ev_counter(), // from base CommandableFragmentGenerator
-      fragment_id(), // ditto
+      bytes,
+      seqid,
+      fragid,
 
       // Needs to be updated to work with the rest of ProtoDUNE-SP
       artdaq::Fragment::FirstUserFragmentType,
@@ -90,29 +215,108 @@ bool CRT::FragGen::getNext_(
       timestamp_
   ));
 
-  // NOTE: we are always returning zero or one fragments, but we
-  // could return more at the cost of some complexity, maybe getting
-  // an efficiency gain.  Check back here if things are too slow.
+  // NOTE: each fragment holds exactly one module packet.  We could
+  // pack more in at the cost of some complexity, maybe getting an
+  // efficiency gain.  Check back here if things are too slow.
   frags.emplace_back(std::move(fragptr));
 
-  memcpy(frags.back()->dataBeginBytes(), readout_buffer_, bytes_read);
+  memcpy(frags.back()->dataBeginBytes(), packet, bytes);
 
-  if (metricMan /* What is this? */ != nullptr)
-    metricMan->sendMetric("Fragments Sent", ev_counter(), "Events", 3,
-        artdaq::MetricMode::LastPoint);
+  metric_fragments_++;
+  metric_bytes_ += bytes;
 
   ev_counter_inc(); // from base CommandableFragmentGenerator
+}
+
+void CRT::FragGen::report_metrics_()
+{
+  const auto now = std::chrono::steady_clock::now();
+  const double elapsed =
+    std::chrono::duration<double>(now - last_metric_time_).count();
+  if(elapsed < metric_interval_s_) return;
+
+  const CRT::decoder_counters dc = CRT::counters;
+  const unsigned long files = hardware_interface_->FilesOpened();
 
-  return true;
+  // metricMan is the global artdaq::MetricManager, which is null if no
+  // metrics have been configured
+  // When sharding, each shard counts its own fragments
+  unsigned long sent = ev_counter();
+  if(!next_sequence_ids_.empty()){
+    sent = 0;
+    for(const auto & next : next_sequence_ids_) sent += next.second - 1;
+  }
+
+  if(metricMan != nullptr){
+    metricMan->sendMetric("Fragments Sent", sent, "Events", 3,
+        artdaq::MetricMode::LastPoint);
+    metricMan->sendMetric("CRT Fragment Rate",
+        metric_fragments_/elapsed, "Fragments/s", 1,
+        artdaq::MetricMode::Average);
+    metricMan->sendMetric("CRT Data Rate",
+        metric_bytes_/elapsed, "Bytes/s", 1,
+        artdaq::MetricMode::Average);
+    metricMan->sendMetric("CRT Parity Errors",
+        (unsigned long)(dc.parity_errors - last_decoder_counters_.parity_errors),
+        "Packets", 1, artdaq::MetricMode::Accumulate);
+    metricMan->sendMetric("CRT Discarded Words",
+        (unsigned long)(dc.discarded_words -
+                        last_decoder_counters_.discarded_words),
+        "Words", 2, artdaq::MetricMode::Accumulate);
+    metricMan->sendMetric("CRT Buffer Rotations",
+        (unsigned long)(dc.rotations - last_decoder_counters_.rotations),
+        "Rotations", 3, artdaq::MetricMode::Accumulate);
+    metricMan->sendMetric("CRT File Switches",
+        files - last_files_opened_, "Files", 2,
+        artdaq::MetricMode::Accumulate);
+    if(sorter_){
+      metricMan->sendMetric("CRT Late Packets",
+          (unsigned long)(sorter_->late() - last_late_packets_), "Packets", 1,
+          artdaq::MetricMode::Accumulate);
+      metricMan->sendMetric("CRT Sorter Depth",
+          (unsigned long)sorter_->size(), "Packets", 2,
+          artdaq::MetricMode::Average);
+    }
+    metricMan->sendMetric("CRT Raw Buffer Occupancy",
+        double(hardware_interface_->RawBufferBytes())
+          / hardware_interface_->RawBufferSize(), "Fraction", 2,
+        artdaq::MetricMode::Average);
+  }
+
+  last_metric_time_ = now;
+  metric_fragments_ = metric_bytes_ = 0;
+  last_decoder_counters_ = dc;
+  last_files_opened_ = files;
+  if(sorter_) last_late_packets_ = sorter_->late();
 }
 
 void CRT::FragGen::start()
 {
+  // Time stamps from the last run mean nothing now.  Forgetting them
+  // means no packets are counted late just because of a restart.
+  if(sorter_){
+    sorter_->clear();
+    last_late_packets_ = sorter_->late();
+  }
+  last_input_time_ = std::chrono::steady_clock::now();
+  stop_event_.clear();
+
+  // Like ev_counter(), per-shard sequence IDs start again from 1
+  for(auto & next : next_sequence_ids_) next.second = 1;
+
   hardware_interface_->StartDatataking();
 }
 
 void CRT::FragGen::stop()
 {
+  // Normally flushed by getNext_ when it saw the stop coming, but it can
+  // miss by a hair.  These are past the checkpoint, so won't come back.
+  if(sorter_ && sorter_->size() > 0){
+    fprintf(stderr, "CRTFragGen: %lu time-sorted module packets were still "
+            "held at stop and are lost\n", (unsigned long)sorter_->size());
+    sorter_->clear();
+  }
+
   // NOTE: Probably let Camillo's DAQ keep running, and then when we
   // get start() again, we'll start with the current second's file.
   // It is ok to return some old data, as in getNext_ comment.
@@ -2,6 +2,7 @@
 
 #include "artdaq-demo/Generators/CRTInterface/CRTInterface.hh"
 #include "artdaq-demo/Generators/CRTInterface/CRTdecode.hh"
+#include "artdaq-demo/Generators/CRTInterface/CRTTimeSorter.hh"
 #define TRACE_NAME "CRTInterface"
 #include "artdaq/DAQdata/Globals.hh"
 #include "artdaq-core-demo/Overlays/FragmentType.hh"
@@ -15,8 +16,12 @@
 #include <cstdlib>
 #include <fcntl.h>
 #include <dirent.h>
+#include <climits>
+#include <ctime>
+#include <algorithm>
 
 #include <sys/inotify.h>
+#include <sys/stat.h>
 
 /**********************************************************************/
 /* Buffers and whatnot */
@@ -33,8 +38,13 @@ static char * next_raw_byte = rawfromhardware;
 CRTInterface::CRTInterface(fhicl::ParameterSet const& ps) :
   indir(ps.get<std::string>("indir")),
   state(CRT_WAIT),
-  taking_data_(false)
+  taking_data_(false),
+  index_dir(ps.get<std::string>("index_dir", "")),
+  index_interval(ps.get<unsigned int>("index_interval", 1000)),
+  checkpoint_file(ps.get<std::string>("checkpoint_file", "")),
+  checkpoint_max_age(ps.get<double>("checkpoint_max_age_s", 60))
 {
+  if(index_interval == 0) index_interval = 1;
 }
 
 // XXX Should this function do a system() call (or something less awful)
@@ -45,43 +55,230 @@ void CRTInterface::StartDatataking()
 {
   taking_data_ = true;
 
-  // Already initialized by call for another board (?)
-  if(inotifyfd != -1){
-    fprintf(stderr, "inotify already init'd.  Maybe this is ok if we\n"
-                    "stopped and restarted data taking...?\n");
-    return;
-  }
+  // Already initialized by a previous start
+  if(inotifyfd == -1){
+    if(-1 == (inotifyfd = inotify_init())){
+      perror("CRTInterface::StartDatataking");
+      _exit(1);
+    }
 
-  if(-1 == (inotifyfd = inotify_init())){
-    perror("CRTInterface::StartDatataking");
-    _exit(1);
+    // Set the file descriptor to non-blocking so that we can immediately
+    // return from FillBuffer() if no data is available.
+    fcntl(inotifyfd, F_SETFL, fcntl(inotifyfd, F_GETFL) | O_NONBLOCK);
   }
 
-  // Set the file descriptor to non-blocking so that we can immediately
-  // return from FillBuffer() if no data is available.
-  fcntl(inotifyfd, F_SETFL, fcntl(inotifyfd, F_GETFL) | O_NONBLOCK);
+  if(!checkpoint_file.empty()) resume_from_checkpoint();
 }
 
 void CRTInterface::StopDatataking()
 {
   taking_data_ = false;
-  if(-1 == inotify_rm_watch(inotifyfd, inotify_watchfd)){
-    perror("CRTInterface::StopDatataking");
-    _exit(1); // maybe not necessary
+
+  if(!checkpoint_file.empty()) write_checkpoint();
+
+  // Whether or not we resume, we will reopen the file and refill the raw
+  // buffer from the file at the next start, so drop what we have.
+  close_file();
+  next_raw_byte = rawfromhardware;
+  state = CRT_WAIT;
+}
+
+/*
+  Closes the data file, if any, along with its inotify watch and index.
+*/
+void CRTInterface::close_file()
+{
+  if(inotify_watchfd != -1){
+    // This fails if the file has been renamed and the watch already
+    // removed automatically, which is fine.
+    inotify_rm_watch(inotifyfd, inotify_watchfd);
+    inotify_watchfd = -1;
+  }
+
+  if(datafile_fd != -1){
+    close(datafile_fd);
+    datafile_fd = -1;
+  }
+
+  index_writer.close();
+}
+
+/*
+  Saves the name of the data file, the offset of the first byte not yet
+  decoded into a module packet, the decoder's notion of the Unix time,
+  and the time now.  If we aren't reading a file, removes any old
+  checkpoint instead, since there is nothing to resume.
+*/
+void CRTInterface::write_checkpoint()
+{
+  if(datafile_fd == -1 || (state & CRT_WAIT)){
+    unlink(checkpoint_file.c_str());
+    return;
+  }
+
+  const uint64_t offset = file_bytes_read > RawBufferBytes()?
+                          file_bytes_read - RawBufferBytes(): 0;
+  const uint32_t unixtime = ((uint32_t)CRT::unix_time_hi << 16)
+                            + CRT::unix_time_lo;
+
+  // Write to a temporary file and rename it, so that a crash can't leave
+  // a half-written checkpoint.
+  const std::string tmpname = checkpoint_file + ".tmp";
+  FILE * out = fopen(tmpname.c_str(), "w");
+  if(out == NULL){
+    perror("CRTInterface: could not write checkpoint");
+    return;
   }
+  fprintf(out, "%s\n%llu %u %ld\n", datafile_name.c_str(),
+          (unsigned long long)offset, unixtime, (long)time(NULL));
+  if(fclose(out) || rename(tmpname.c_str(), checkpoint_file.c_str()))
+    perror("CRTInterface: could not write checkpoint");
+}
+
+/*
+  Counts the data files in 'indir' that were finished after 'filename' was:
+  everything but ".wr" files, baselines, index files and directories, that
+  was last modified later than it.
+*/
+static unsigned int count_finished_after(const std::string & indir,
+                                         const std::string & filename)
+{
+  struct stat st;
+  if(stat(filename.c_str(), &st) != 0) return 0;
+  const time_t finished = st.st_mtime;
+
+  DIR * dp = opendir(indir.c_str());
+  if(dp == NULL) return 0;
+
+  unsigned int n = 0;
+  for(struct dirent * de; (de = readdir(dp)) != NULL; ){
+    const std::string name = de->d_name;
+    const std::string path = indir + "/" + name;
+    const auto ends_with = [&name](const char * suffix){
+      const size_t len = strlen(suffix);
+      return name.size() >= len &&
+             name.compare(name.size() - len, len, suffix) == 0;
+    };
+    if(name[0] == '.' || ends_with(".wr") || ends_with(".idx") ||
+       name.find("baseline") != std::string::npos || path == filename)
+      continue;
+    if(stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode) &&
+       st.st_mtime > finished)
+      n++;
+  }
+  closedir(dp);
+  return n;
+}
+
+/*
+  Reopens the file named in the checkpoint file at the saved position and
+  restores the decoder's Unix time.  If the checkpoint is missing, too
+  old, or its file is gone, returns false and leaves us waiting for a new
+  file as usual.
+
+  Only the checkpointed file is resumed.  If it has been finished since,
+  then after it we go on to the file being written now, as always, so any
+  files the upstream DAQ finished in between are skipped.  We say so.
+*/
+bool CRTInterface::resume_from_checkpoint()
+{
+  FILE * in = fopen(checkpoint_file.c_str(), "r");
+  if(in == NULL) return false;
+
+  char name[PATH_MAX + 1];
+  unsigned long long offset = 0;
+  unsigned int unixtime = 0;
+  long saved = 0;
+  const bool ok = fgets(name, sizeof name, in) != NULL &&
+                  fscanf(in, "%llu %u %ld", &offset, &unixtime, &saved) == 3;
+  fclose(in);
+
+  if(!ok){
+    fprintf(stderr, "CRTInterface: ignoring unreadable checkpoint %s\n",
+            checkpoint_file.c_str());
+    return false;
+  }
+  name[strcspn(name, "\n")] = '\0';
+
+  const double age = difftime(time(NULL), saved);
+  if(age > checkpoint_max_age){
+    printf("CRTInterface: checkpoint is %.0fs old; skipping ahead\n", age);
+    return false;
+  }
+
+  // If the file is still being written, watch it as usual.  If it has been
+  // finished, it was renamed without the ".wr", and we just need to read
+  // the rest of it.
+  std::string filename = name;
+  bool finished = false;
+  if(access(filename.c_str(), R_OK) != 0){
+    if(filename.size() > 3 &&
+       filename.compare(filename.size() - 3, 3, ".wr") == 0)
+      filename.resize(filename.size() - 3);
+    if(access(filename.c_str(), R_OK) != 0){
+      printf("CRTInterface: checkpointed file %s is gone\n", name);
+      return false;
+    }
+    finished = true;
+  }
+
+  if(!finished && -1 == (inotify_watchfd =
+                 inotify_add_watch(inotifyfd, filename.c_str(),
+                                   IN_MODIFY | IN_MOVE_SELF))){
+    perror("CRTInterface: could not resume from checkpoint");
+    return false;
+  }
+
+  if(-1 == (datafile_fd = open(filename.c_str(), O_RDONLY)) ||
+     (off_t)-1 == lseek(datafile_fd, offset, SEEK_SET)){
+    perror("CRTInterface: could not resume from checkpoint");
+    close_file();
+    return false;
+  }
+
+  printf("CRTInterface: resuming %s at byte %llu\n", filename.c_str(), offset);
+
+  if(finished){
+    const unsigned int skipped = count_finished_after(indir, filename);
+    if(skipped > 0)
+      fprintf(stderr, "CRTInterface: WARNING: %u input file%s finished after "
+              "%s while we were stopped and will not be read\n", skipped,
+              skipped == 1? "": "s", filename.c_str());
+  }
+
+  files_opened++;
+
+  datafile_name = name;
+  file_bytes_read = offset;
+  CRT::unix_time_hi = unixtime >> 16;
+  CRT::unix_time_lo = unixtime & 0xffff;
+
+  // We don't know the latest packet time before this point, so we can't
+  // continue this file's index correctly.  Leave it as it is.
+  packets_in_file = 0;
+  maxtime_in_file = 0;
+
+  // Read immediately, since we won't hear about writes made while stopped
+  state = CRT_READ_ACTIVE | CRT_READ_MORE;
+  if(finished) state |= CRT_READ_CLOSED;
+
+  return true;
 }
 
 // NOTE: probably want to skip forward to the file named after the current
 // second in case Camillo's DAQ was started up a long time ago.
-char * find_wr_file(const std::string & indir)
+//
+// Sets 'missing' if the directory doesn't exist (yet).
+char * find_wr_file(const std::string & indir, bool & missing)
 {
   DIR * dp = NULL;
   errno = 0;
+  missing = false;
   if((dp = opendir(indir.c_str())) == NULL){
     if(errno == ENOENT){
       fprintf(stderr, "No such directory %s, but will wait for it\n",
               indir.c_str());
-      usleep(100000);
+      missing = true;
       return NULL;
     }
     else{
@@ -140,7 +337,7 @@ char * find_wr_file(const std::string & indir)
 */
 bool CRTInterface::try_open_file()
 {
-  const char * const filename = find_wr_file(indir);
+  const char * const filename = find_wr_file(indir, indir_missing);
 
   if(filename == NULL) return false;
 
@@ -181,6 +378,14 @@ bool CRTInterface::try_open_file()
   }
 
   state = CRT_READ_ACTIVE;
+  files_opened++;
+
+  datafile_name = fullfilename;
+  file_bytes_read = 0;
+  packets_in_file = 0;
+  maxtime_in_file = 0;
+  if(!index_dir.empty())
+    index_writer.open(CRT::index_file_name(index_dir, filename));
 
   return true;
 }
@@ -241,6 +446,8 @@ bool CRTInterface::check_events()
     // written to.  We should find the next file.
     if(state == CRT_READ_ACTIVE){
       close(datafile_fd);
+      datafile_fd = -1;
+      index_writer.close();
 
       // XXX Is this desired?
       //unlink(datafile_fd);
@@ -274,6 +481,7 @@ size_t CRTInterface::read_everything_from_file(char * cooked_data)
     if(read_bread != 1) break;
 
     next_raw_byte += read_bread;
+    file_bytes_read += read_bread;
   }
 
   // We're leaving unread data in the file, so we will need to come back and
@@ -287,13 +495,38 @@ size_t CRTInterface::read_everything_from_file(char * cooked_data)
     _exit(1);
   }
 
-  const int bytesleft = next_raw_byte - rawfromhardware;
-  printf("%d bytes in raw buffer after read.\n", bytesleft);
+  if(next_raw_byte > rawfromhardware) state |= CRT_DRAIN_BUFFER;
 
-  if(bytesleft > 0) state |= CRT_DRAIN_BUFFER;
+  return decode(cooked_data);
+}
 
-  return CRT::raw2cook(cooked_data, COOKEDBUFSIZE,
-                       rawfromhardware, next_raw_byte);
+/*
+  Decodes at most one module packet from the raw buffer into 'cooked_data',
+  returning its size, and makes an index entry for it if it is time to.
+*/
+size_t CRTInterface::decode(char * cooked_data)
+{
+  // Where in the file the undecoded data starts.  Since raw2cook() starts
+  // decoding at the front of the buffer, starting here gives the same
+  // result as what we're about to get.  Except that the buffer can hold
+  // the tail of the previous file for a moment after we switch files.
+  const uint64_t offset = file_bytes_read > RawBufferBytes()?
+                          file_bytes_read - RawBufferBytes(): 0;
+  const uint32_t unixtime = ((uint32_t)CRT::unix_time_hi << 16)
+                            + CRT::unix_time_lo;
+
+  const size_t bytes = CRT::raw2cook(cooked_data, COOKEDBUFSIZE,
+                                     rawfromhardware, next_raw_byte);
+  if(bytes == 0) return 0;
+
+  if(index_writer.is_open() && packets_in_file % index_interval == 0)
+    index_writer.add(offset, maxtime_in_file, unixtime);
+
+  packets_in_file++;
+  maxtime_in_file = std::max(maxtime_in_file,
+                             CRT::TimeSorter::packet_time(cooked_data));
+
+  return bytes;
 }
 
 void CRTInterface::FillBuffer(char* cooked_data, size_t* bytes_ret)
@@ -303,10 +536,7 @@ void CRTInterface::FillBuffer(char* cooked_data, size_t* bytes_ret)
   // First see if we can decode another module packet out of the data already
   // read from the input files.
   if(state & CRT_DRAIN_BUFFER){
-    printf("%ld bytes in raw buffer before read.\n",
-           next_raw_byte - rawfromhardware);
-    if((*bytes_ret = CRT::raw2cook(cooked_data, COOKEDBUFSIZE,
-                                   rawfromhardware, next_raw_byte)))
+    if((*bytes_ret = decode(cooked_data)))
       return;
     else
       state &= ~CRT_DRAIN_BUFFER;
@@ -318,6 +548,13 @@ void CRTInterface::FillBuffer(char* cooked_data, size_t* bytes_ret)
     if((*bytes_ret = read_everything_from_file(cooked_data))) return;
   }
 
+  // If the file is finished and we've got everything out of it, move on.
+  if((state & CRT_READ_CLOSED) &&
+     !(state & (CRT_READ_MORE | CRT_DRAIN_BUFFER))){
+    close_file();
+    state = CRT_WAIT;
+  }
+
   // This should only happen when we open the first file.  Otherwise,
   // the first read to a new file is handled below.
   if(state & CRT_WAIT){
@@ -348,6 +585,39 @@ void CRTInterface::FillBuffer(char* cooked_data, size_t* bytes_ret)
   *bytes_ret = read_everything_from_file(cooked_data);
 }
 
+int CRTInterface::IdleWait(int * timeout_ms) const
+{
+  // Nothing tells us when the upstream DAQ starts a new file, so look
+  // again soon, or less often if it hasn't even made the directory yet.
+  if(state & CRT_WAIT){
+    *timeout_ms = indir_missing? 100: 1;
+    return -1;
+  }
+
+  // There is still buffered data to decode or more of the file to read,
+  // so there's no reason to wait at all.
+  if(state != CRT_READ_ACTIVE){
+    *timeout_ms = 0;
+    return -1;
+  }
+
+  // We've read everything in the file so far.  inotify will tell us when
+  // it is written to or renamed.  Time out now and then anyway so that
+  // metrics keep being sent.
+  *timeout_ms = 100;
+  return inotifyfd;
+}
+
+size_t CRTInterface::RawBufferBytes() const
+{
+  return next_raw_byte - rawfromhardware;
+}
+
+size_t CRTInterface::RawBufferSize() const
+{
+  return RAWBUFSIZE;
+}
+
 void CRTInterface::AllocateReadoutBuffer(char** cooked_data)
 {
   *cooked_data = new char[COOKEDBUFSIZE];
@@ -5,6 +5,8 @@
 
 #include "artdaq-core-demo/Overlays/FragmentType.hh"
 
+#include "artdaq-demo/Generators/CRTInterface/CRTTimeIndex.hh"
+
 #include "fhiclcpp/fwd.h"
 
 #include <random>
@@ -27,7 +29,12 @@ CRT_READ_MORE = 0x04,
 // We've read some data into our internal buffer and it may decode
 // to one or more module packets, so read it before going back to
 // the input files.
-CRT_DRAIN_BUFFER = 0x08;
+CRT_DRAIN_BUFFER = 0x08,
+
+// The file we are reading is no longer being written to, which happens
+// when we resume from a checkpoint in a file that has since been
+// finished.  Once we've read and decoded all of it, go find the next one.
+CRT_READ_CLOSED = 0x10;
 
 class CRTInterface
 {
@@ -35,8 +42,18 @@ public:
 
 	explicit CRTInterface(fhicl::ParameterSet const& ps);
 
+	/**
+	 * \brief Start looking for data.  If "checkpoint_file" is configured
+	 * and holds a recent enough position, resume reading from there.
+	 * Only that file is resumed: files finished after it while we were
+	 * stopped are skipped, with a warning.
+	 */
 	void StartDatataking();
 
+	/**
+	 * \brief Stop reading and close the input file.  If "checkpoint_file"
+	 * is configured, first save our position in it for StartDatataking().
+	 */
 	void StopDatataking();
 
 	/**
@@ -63,6 +80,32 @@ public:
 	 */
 	void FreeReadoutBuffer(char* buffer);
 
+  /**
+   * \brief How to wait for data after FillBuffer() has returned none
+   *
+   * \param timeout_ms (output) Longest to wait before calling FillBuffer()
+   * again, in milliseconds
+   * \return A file descriptor that becomes readable when there may be
+   * more data, or -1 if there is none to wait on
+   */
+  int IdleWait(int * timeout_ms) const;
+
+  /**
+   * \brief Number of undecoded bytes waiting in the raw input buffer
+   */
+  size_t RawBufferBytes() const;
+
+  /**
+   * \brief Capacity of the raw input buffer, in bytes
+   */
+  size_t RawBufferSize() const;
+
+  /**
+   * \brief Number of input files opened since construction.  Each one
+   * after the first is a switch to a new file by the upstream DAQ.
+   */
+  unsigned long FilesOpened() const { return files_opened; }
+
 private:
 
   // The directory in which to look for input files.  This is probably
@@ -70,6 +113,9 @@ private:
   // path.
   std::string indir;
 
+  // Whether indir didn't exist the last time we looked in it
+  bool indir_missing = false;
+
   // State: whether we are reading an input file, waiting for one, etc.
   // bitmask of CRT_* defined above
   unsigned int state;
@@ -86,10 +132,36 @@ private:
   // File descriptor for the data file we are reading
   int datafile_fd = -1;
 
+  // How many input files we have opened, for monitoring
+  unsigned long files_opened = 0;
+
+  // Full name of, and bytes read so far from, the data file we are reading
+  std::string datafile_name;
+  uint64_t file_bytes_read = 0;
+
+  // If not empty, write a sidecar index of each input file here, with an
+  // entry every 'index_interval' module packets.
+  std::string index_dir;
+  unsigned int index_interval;
+  CRT::TimeIndexWriter index_writer;
+  uint64_t packets_in_file = 0;
+  uint64_t maxtime_in_file = 0;
+
+  // If not empty, where to save our position at stop so that we can pick
+  // up where we left off at the next start, provided that the position is
+  // no more than checkpoint_max_age seconds old.  Otherwise we skip ahead
+  // to whatever file the upstream DAQ is writing now.
+  std::string checkpoint_file;
+  double checkpoint_max_age;
+
   // Private functions documented in the implementation.
   bool try_open_file();
   bool check_events();
   size_t read_everything_from_file(char * );
+  size_t decode(char * );
+  void close_file();
+  void write_checkpoint();
+  bool resume_from_checkpoint();
 };
 
 #endif
@@ -0,0 +1,88 @@
+/* Author: Matthew Strait <mstrait@fnal.gov> */
+
+#include "artdaq-demo/Generators/CRTInterface/CRTTimeIndex.hh"
+#include "artdaq-demo/Generators/CRTInterface/CRTdecode.hh"
+
+#include <unistd.h>
+#include <algorithm>
+
+bool CRT::TimeIndexWriter::open(const std::string & filename)
+{
+  close();
+  if((file = fopen(filename.c_str(), "w")) == NULL){
+    perror(("CRT: Could not open index file " + filename).c_str());
+    return false;
+  }
+  return true;
+}
+
+void CRT::TimeIndexWriter::add(const uint64_t offset,
+                               const uint64_t maxtime_ns,
+                               const uint32_t unixtime)
+{
+  if(file == NULL) return;
+
+  // stdio buffers this, so this is not a write() per entry
+  const index_entry entry = { offset, maxtime_ns, unixtime, 0 };
+  if(fwrite(&entry, sizeof entry, 1, file) != 1){
+    perror("CRT: Could not write to index file; giving up on it");
+    close();
+  }
+}
+
+void CRT::TimeIndexWriter::close()
+{
+  if(file == NULL) return;
+  if(fclose(file)) perror("CRT: closing index file");
+  file = NULL;
+}
+
+CRT::TimeIndexReader::TimeIndexReader(const std::string & filename)
+{
+  FILE * file = fopen(filename.c_str(), "r");
+  if(file == NULL) return;
+
+  index_entry entry;
+  while(fread(&entry, sizeof entry, 1, file) == 1) entries.push_back(entry);
+
+  fclose(file);
+}
+
+bool CRT::TimeIndexReader::find(const uint64_t time_ns,
+                                index_entry & entry) const
+{
+  if(entries.empty()) return false;
+
+  // maxtime_ns never decreases along the file, so we can bisect for the
+  // first entry that is too late and step back one.
+  const auto after = std::lower_bound(entries.begin(), entries.end(), time_ns,
+    [](const index_entry & e, const uint64_t t){ return e.maxtime_ns < t; });
+
+  entry = after == entries.begin()? entries.front(): *(after - 1);
+  return true;
+}
+
+bool CRT::seek_to_time(const int datafd, const std::string & indexfile,
+                       const uint64_t time_ns)
+{
+  index_entry entry;
+  if(!TimeIndexReader(indexfile).find(time_ns, entry)) return false;
+
+  if(lseek(datafd, entry.offset, SEEK_SET) == (off_t)-1){
+    perror("CRT::seek_to_time");
+    return false;
+  }
+
+  unix_time_hi = entry.unixtime >> 16;
+  unix_time_lo = entry.unixtime & 0xffff;
+  return true;
+}
+
+std::string CRT::index_file_name(const std::string & indexdir,
+                                 const std::string & datafile)
+{
+  std::string base = datafile.substr(datafile.rfind('/') + 1);
+  if(base.size() > 3 && base.compare(base.size() - 3, 3, ".wr") == 0)
+    base.resize(base.size() - 3);
+  return indexdir + "/" + base + ".idx";
+}
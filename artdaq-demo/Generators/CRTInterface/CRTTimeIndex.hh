@@ -0,0 +1,92 @@
+/* Author: Matthew Strait <mstrait@fnal.gov> */
+
+#ifndef artdaq_Generators_CRTInterface_CRTTimeIndex_hh
+#define artdaq_Generators_CRTInterface_CRTTimeIndex_hh
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace CRT{
+
+/*
+  One entry of a sidecar index for a raw CRT input file.  Decoding from
+  'offset' gives correct results provided that the decoder's Unix time is
+  first set to 'unixtime', and no module packet decoded from before
+  'offset' has a time later than 'maxtime_ns'.  So to find everything at or
+  after some time T, start at the last entry with maxtime_ns < T.
+
+  Times are in nanoseconds as given by TimeSorter::packet_time().
+
+  The index file is simply these records back to back, in file order, in
+  the native byte order.
+*/
+struct index_entry {
+  uint64_t offset;
+  uint64_t maxtime_ns;
+  uint32_t unixtime;
+  uint32_t unused;
+};
+
+/*
+  Writes index entries for one raw file.  Does nothing unless open.
+*/
+class TimeIndexWriter {
+public:
+  TimeIndexWriter() {}
+  ~TimeIndexWriter() { close(); }
+
+  // Open 'filename' for writing, truncating it.  Returns false on failure.
+  bool open(const std::string & filename);
+
+  void add(uint64_t offset, uint64_t maxtime_ns, uint32_t unixtime);
+
+  void close();
+
+  bool is_open() const { return file != NULL; }
+
+private:
+  TimeIndexWriter(const TimeIndexWriter &) = delete;
+  TimeIndexWriter & operator=(const TimeIndexWriter &) = delete;
+
+  FILE * file = NULL;
+};
+
+/*
+  Reads a whole index file and finds where to start decoding for a given
+  time by binary search.
+*/
+class TimeIndexReader {
+public:
+  // Reads 'filename'.  If it can't be read, the index is empty.
+  explicit TimeIndexReader(const std::string & filename);
+
+  /*
+    Sets 'entry' to where to start decoding to find all module packets at
+    or after 'time_ns'.  Returns false if the index is empty.
+  */
+  bool find(uint64_t time_ns, index_entry & entry) const;
+
+  size_t size() const { return entries.size(); }
+
+private:
+  std::vector<index_entry> entries;
+};
+
+/*
+  Positions 'datafd', an open raw CRT file, at the place 'indexfile' says
+  to start to find all data at or after 'time_ns', and sets the decoder's
+  Unix time to match.  Returns false, and does nothing, if the index can't
+  be used.
+*/
+bool seek_to_time(int datafd, const std::string & indexfile, uint64_t time_ns);
+
+// Name of the index file for raw file 'datafile' (with or without ".wr")
+// in directory 'indexdir'.
+std::string index_file_name(const std::string & indexdir,
+                            const std::string & datafile);
+
+}
+
+#endif
@@ -0,0 +1,87 @@
+/* Author: Matthew Strait <mstrait@fnal.gov> */
+
+#include "artdaq-demo/Generators/CRTInterface/CRTTimeSorter.hh"
+
+#include <string.h>
+#include <algorithm>
+
+CRT::TimeSorter::TimeSorter(const uint64_t latency_ns_) :
+  latency_ns(latency_ns_)
+{
+}
+
+/*
+  See the comment above serialize() in CRTdecode.cc for the module packet
+  layout.  The Unix time stamp is at byte 4 and the counter, in 20ns ticks,
+  at byte 8.
+
+  The counter runs from the last sync pulse, not from the top of the Unix
+  second, and nothing in the data says when that pulse was.  Unix time plus
+  counter is therefore only a guess at the real time, and a counter that
+  has run past a second could put a packet after ones stamped with a later
+  Unix second.  So the counter is clamped to just under a second: the Unix
+  time decides the order, and the counter only orders packets within the
+  same Unix second.  Packets in a second where the sync pulse arrived can
+  still come out of order relative to each other, by up to the length of
+  that second.
+*/
+uint64_t CRT::TimeSorter::packet_time(const char * packet)
+{
+  uint32_t timeunix, time16ns;
+  memcpy(&timeunix, packet + 4, sizeof timeunix);
+  memcpy(&time16ns, packet + 8, sizeof time16ns);
+  const uint64_t since_sync = std::min(uint64_t(time16ns)*20,
+                                       uint64_t(999999999));
+  return uint64_t(timeunix)*1000000000 + since_sync;
+}
+
+bool CRT::TimeSorter::push(const char * packet, const size_t size)
+{
+  const uint64_t time = packet_time(packet);
+
+  if(time < last_released){
+    nlate++;
+    return false;
+  }
+
+  held_packet p;
+  p.time = time;
+  p.order = npushed++;
+  if(!spare.empty()){
+    p.data.swap(spare.back());
+    spare.pop_back();
+  }
+  p.data.assign(packet, packet + size);
+
+  heap.push_back(std::move(p));
+  std::push_heap(heap.begin(), heap.end(), later());
+
+  if(time > latest) latest = time;
+  return true;
+}
+
+const std::vector<char> * CRT::TimeSorter::ready(const bool force) const
+{
+  if(heap.empty()) return NULL;
+
+  const held_packet & first = heap.front();
+  if(force || latest - first.time >= latency_ns) return &first.data;
+  return NULL;
+}
+
+void CRT::TimeSorter::pop()
+{
+  if(heap.empty()) return;
+
+  std::pop_heap(heap.begin(), heap.end(), later());
+  last_released = heap.back().time;
+  spare.push_back(std::move(heap.back().data));
+  heap.pop_back();
+}
+
+void CRT::TimeSorter::clear()
+{
+  for(auto & p : heap) spare.push_back(std::move(p.data));
+  heap.clear();
+  latest = last_released = npushed = 0;
+}
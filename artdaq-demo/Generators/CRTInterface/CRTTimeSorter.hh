@@ -0,0 +1,92 @@
+/* Author: Matthew Strait <mstrait@fnal.gov> */
+
+#ifndef artdaq_Generators_CRTInterface_CRTTimeSorter_hh
+#define artdaq_Generators_CRTInterface_CRTTimeSorter_hh
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+namespace CRT{
+
+/*
+  Puts module packets, as produced by raw2cook(), into time order.
+
+  Packets come to us in the order they appear in the input files, which
+  is not time order across modules.  We hold them in a min-heap keyed on
+  their time stamp and release the earliest one only once it is older
+  than the "watermark", which is the latest time stamp we have seen minus
+  a latency budget.  So as long as no packet arrives more than the
+  budget later than a packet with a later time stamp, the output is in
+  time order.
+
+  A packet that arrives with a time stamp earlier than one we have already
+  released cannot be put in order.  It is dropped and counted as late.
+
+  The order is only as good as the time stamps.  Within one Unix second,
+  packets are ordered by the 50 MHz counter, which restarts at each sync
+  pulse rather than at the top of the second; see packet_time().
+*/
+class TimeSorter {
+public:
+  explicit TimeSorter(uint64_t latency_ns);
+
+  /*
+    Takes a copy of the module packet of 'size' bytes at 'packet'.
+    Returns false if it is too late to be put in order, in which case it
+    has been dropped.
+  */
+  bool push(const char * packet, size_t size);
+
+  /*
+    Returns the earliest held packet if it is below the watermark, or if
+    'force' is set and there is any packet at all.  Otherwise NULL.  The
+    pointer is good until the next call to push(), pop() or clear().
+  */
+  const std::vector<char> * ready(bool force = false) const;
+
+  // Drops the packet last returned by ready().
+  void pop();
+
+  // Drops everything and forgets all time stamps seen.
+  void clear();
+
+  size_t size() const { return heap.size(); }
+
+  uint64_t late() const { return nlate; }
+
+  // The sort key of a module packet: its time in nanoseconds, as far as
+  // it can be told.  Never goes backwards as the Unix time stamp goes
+  // forwards; see the .cc file for why that is as good as it gets.
+  static uint64_t packet_time(const char * packet);
+
+private:
+  struct held_packet {
+    uint64_t time;
+    uint64_t order; // arrival order, to keep equal times stable
+    std::vector<char> data;
+  };
+
+  struct later {
+    bool operator()(const held_packet & a, const held_packet & b) const
+    {
+      return a.time != b.time? a.time > b.time: a.order > b.order;
+    }
+  };
+
+  uint64_t latency_ns;
+
+  std::vector<held_packet> heap;
+
+  // Storage of released packets, kept to avoid an allocation per packet
+  std::vector< std::vector<char> > spare;
+
+  uint64_t latest = 0;        // latest time stamp pushed
+  uint64_t last_released = 0; // time stamp of the last packet popped
+  uint64_t npushed = 0;
+  uint64_t nlate = 0;
+};
+
+}
+
+#endif
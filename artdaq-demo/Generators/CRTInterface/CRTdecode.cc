@@ -6,8 +6,12 @@
 #include <deque>
 #include <vector>
 
+#include "artdaq-demo/Generators/CRTInterface/CRTdecode.hh"
+
 namespace CRT{
 
+decoder_counters counters = { 0, 0, 0 };
+
 // The raw data stream occasionally has packets that tell the Unix time of the
 // upstream CRT DAQ.  Once we get one of these, copy the latest Unix time into
 // the output events.  Before this point, we'll write zeros, and probably
@@ -255,7 +259,7 @@ unsigned int make_a_packet(char * cooked, std::deque<uint16_t> & raw,
   // First word of all packets other than unix timestamp packets is 0xffff
   // If there's any junk before 0xffff, discard it.
   while(!raw.empty() && raw[0] != 0xffff){
-    printf("CRT: Discarding word 0x%04x appearing before 0xffff\n", raw[0]);
+    counters.discarded_words++;
     raw.pop_front();
   }
 
@@ -264,6 +268,7 @@ unsigned int make_a_packet(char * cooked, std::deque<uint16_t> & raw,
   unsigned int len = raw[ADC_WIDX_MODLEN] & 0xff;
   if(len == 0){
     printf("CRT: Discarding packet with declared length zero.\n");
+    counters.discarded_words += raw.size();
     raw.clear();
     return 0;
   }
@@ -277,6 +282,7 @@ unsigned int make_a_packet(char * cooked, std::deque<uint16_t> & raw,
     // Throw out what we have so far, and then rely upon looking for
     // the leading 0xffff data word to throw out the rest of whatever
     // this is.
+    counters.discarded_words += raw.size();
     raw.clear();
     return 0;
   }
@@ -313,7 +319,7 @@ unsigned int make_a_packet(char * cooked, std::deque<uint16_t> & raw,
   for(unsigned int i = 0; i < len + 1; i++) raw.pop_front();
 
   if(!goodparity){
-    printf("CRT: Parity error.  Dropping packet.\n");
+    counters.parity_errors++;
     return 0;
   }
 
@@ -402,14 +408,9 @@ unsigned int raw2cook(char * const cooked_data,
   // Rotate buffer in the most wasteful way possible, by actually moving
   // the undecoded bytes to the front.
   if(used_raw_bytes){
-    printf("Used %u bytes, and rotating %ld to front for later use.\n",
-           used_raw_bytes,
-           next_raw_byte - rawfromhardware - used_raw_bytes);
     memmove(rawfromhardware, rawfromhardware + used_raw_bytes,
             next_raw_byte - rawfromhardware - used_raw_bytes);
-  }
-  else{
-    printf("Used 0 bytes\n");
+    counters.rotations++;
   }
 
   next_raw_byte -= used_raw_bytes;
@@ -1,7 +1,29 @@
 /* Author: Matthew Strait <mstrait@fnal.gov> */
 
+#ifndef artdaq_Generators_CRTInterface_CRTdecode_hh
+#define artdaq_Generators_CRTInterface_CRTdecode_hh
+
+#include <stdint.h>
+
 namespace CRT{
 
+/*
+  Running counts of things the decoder has thrown away or done that are
+  too frequent to be worth a message each time.  They only ever go up;
+  whoever wants rates should difference successive readings.
+*/
+struct decoder_counters {
+  uint64_t parity_errors;   // module packets dropped for bad parity
+  uint64_t discarded_words; // 16-bit words dropped while resynchronizing
+  uint64_t rotations;       // times the raw buffer was shifted down
+};
+
+extern decoder_counters counters;
+
+// The latest Unix time from the raw data stream, which is stamped on each
+// module packet.  Zero until the first Unix time packet is seen.
+extern uint16_t unix_time_hi, unix_time_lo;
+
 /*
   Decodes the data in 'rawfromhardware' and puts the result in
   'cooked_data', returning the number of bytes put into cooked_data,
@@ -28,3 +50,5 @@ unsigned int raw2cook(char * const cooked_data,
                       char * & next_raw_byte);
 
 }
+
+#endif
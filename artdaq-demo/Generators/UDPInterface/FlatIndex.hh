@@ -0,0 +1,117 @@
+#ifndef artdaq_demo_Generators_UDPInterface_FlatIndex_hh
+#define artdaq_demo_Generators_UDPInterface_FlatIndex_hh
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace demo
+{
+	/**
+	 * \brief A hash map from 64-bit keys to 32-bit indices, stored in one flat array
+	 *
+	 * Open addressing with linear probing, so a lookup is a multiply, a shift
+	 * and (almost always) one cache line. Meant for a few dozen to a few
+	 * thousand keys that are added but never removed individually, such as
+	 * the senders a receiver has heard from.
+	 */
+	class FlatIndex
+	{
+	public:
+		static const uint32_t npos = 0xFFFFFFFF; ///< Value meaning "not found"
+
+		/**
+		 * \brief FlatIndex Constructor
+		 * \param capacity Number of keys to make room for before the table has to grow
+		 */
+		explicit FlatIndex(size_t capacity = 16)
+			: size_(0)
+		{
+			size_t buckets = 16;
+			while (buckets < 2 * capacity) buckets <<= 1;
+			resize_(buckets);
+		}
+
+		/**
+		 * \brief Look up a key
+		 * \param key The key
+		 * \return The value stored for the key, or npos
+		 */
+		uint32_t find(uint64_t key) const
+		{
+			for (size_t ii = bucket_(key);; ii = (ii + 1) & mask_)
+			{
+				if (buckets_[ii].value == npos) return npos;
+				if (buckets_[ii].key == key) return buckets_[ii].value;
+			}
+		}
+
+		/**
+		 * \brief Add a key, which must not already be present
+		 * \param key The key
+		 * \param value The value to store for it. Must not be npos
+		 */
+		void insert(uint64_t key, uint32_t value)
+		{
+			// Keep the table at most half full, so that probe sequences stay short
+			if (2 * (size_ + 1) > buckets_.size())
+			{
+				std::vector<Bucket> old;
+				old.swap(buckets_);
+				resize_(old.size() * 2);
+				for (auto const& bucket : old)
+				{
+					if (bucket.value != npos) place_(bucket.key, bucket.value);
+				}
+			}
+			place_(key, value);
+			++size_;
+		}
+
+		/**
+		 * \brief Remove every key
+		 */
+		void clear()
+		{
+			for (auto& bucket : buckets_) bucket.value = npos;
+			size_ = 0;
+		}
+
+		/**
+		 * \brief Get the number of keys
+		 * \return The number of keys present
+		 */
+		size_t size() const { return size_; }
+
+	private:
+		struct Bucket
+		{
+			uint64_t key;
+			uint32_t value;
+		};
+
+		size_t bucket_(uint64_t key) const { return (key * 0x9E3779B97F4A7C15ull) >> shift_; }
+
+		void resize_(size_t buckets)
+		{
+			buckets_.assign(buckets, Bucket{0, npos});
+			mask_ = buckets - 1;
+			shift_ = 64;
+			while (buckets > 1) { --shift_; buckets >>= 1; }
+		}
+
+		void place_(uint64_t key, uint32_t value)
+		{
+			size_t ii = bucket_(key);
+			while (buckets_[ii].value != npos) ii = (ii + 1) & mask_;
+			buckets_[ii] = Bucket{key, value};
+		}
+
+		std::vector<Bucket> buckets_;
+		size_t mask_;
+		unsigned shift_;
+		size_t size_;
+	};
+}
+
+#endif /* artdaq_demo_Generators_UDPInterface_FlatIndex_hh */
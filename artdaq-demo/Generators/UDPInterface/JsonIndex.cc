@@ -0,0 +1,321 @@
+#include "artdaq-demo/Generators/UDPInterface/JsonIndex.hh"
+
+#include <cstdlib>
+#include <cstring>
+
+const uint32_t demo::JsonIndex::magic;
+const uint16_t demo::JsonIndex::noParent;
+const size_t demo::JsonIndex::maxDepth;
+
+namespace
+{
+	// Powers of ten that a double holds exactly
+	const double exactPowers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	                              1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+	bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+	/**
+	 * \brief Cursor over the text, which is NUL-terminated, so that looking one byte past the end is safe
+	 */
+	struct Scanner
+	{
+		const char* text;
+		size_t size;
+		size_t pos;
+
+		void skipSpace()
+		{
+			while (pos < size && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' || text[pos] == '\r')) ++pos;
+		}
+
+		bool peek(char c) const { return pos < size && text[pos] == c; }
+
+		// Past the closing quote of a string starting at pos
+		bool string()
+		{
+			if (!peek('"')) return false;
+			for (++pos; pos < size; ++pos)
+			{
+				if (text[pos] == '\\') ++pos;
+				else if (text[pos] == '"')
+				{
+					++pos;
+					return true;
+				}
+			}
+			return false;
+		}
+
+		bool literal(const char* word)
+		{
+			size_t length = strlen(word);
+			if (pos + length > size || memcmp(text + pos, word, length) != 0) return false;
+			pos += length;
+			return true;
+		}
+
+		// Past a number starting at pos, checking it against the JSON grammar
+		bool number(double& value)
+		{
+			size_t start = pos;
+			bool negative = peek('-');
+			if (negative) ++pos;
+
+			uint64_t mantissa = 0;
+			int digits = 0;
+			int exponent = 0;
+			if (peek('0')) ++pos;
+			else if (pos < size && isDigit(text[pos]))
+			{
+				for (; pos < size && isDigit(text[pos]); ++pos)
+				{
+					if (digits < 19) mantissa = mantissa * 10 + (text[pos] - '0');
+					else ++exponent;
+					if (mantissa != 0) ++digits;
+				}
+			}
+			else return false;
+
+			if (peek('.'))
+			{
+				++pos;
+				if (pos >= size || !isDigit(text[pos])) return false;
+				for (; pos < size && isDigit(text[pos]); ++pos)
+				{
+					if (digits < 19)
+					{
+						mantissa = mantissa * 10 + (text[pos] - '0');
+						--exponent;
+						if (mantissa != 0) ++digits;
+					}
+				}
+			}
+
+			if (peek('e') || peek('E'))
+			{
+				++pos;
+				bool negativeExponent = peek('-');
+				if (peek('-') || peek('+')) ++pos;
+				if (pos >= size || !isDigit(text[pos])) return false;
+				int written = 0;
+				for (; pos < size && isDigit(text[pos]); ++pos)
+				{
+					if (written < 10000) written = written * 10 + (text[pos] - '0');
+				}
+				exponent += negativeExponent ? -written : written;
+			}
+
+			// Exact when both the mantissa and the power of ten are exact doubles;
+			// otherwise leave it to the C library
+			if (mantissa < (uint64_t(1) << 53) && exponent >= -22 && exponent <= 22)
+			{
+				value = exponent < 0 ? double(mantissa) / exactPowers[-exponent] : double(mantissa) * exactPowers[exponent];
+				if (negative) value = -value;
+			}
+			else
+			{
+				value = strtod(text + start, nullptr);
+			}
+			return true;
+		}
+	};
+
+	void putEntry(uint8_t* out, size_t index, demo::JsonIndex::Entry const& entry)
+	{
+		memcpy(out + demo::JsonIndex::bytes(index), &entry, sizeof(entry));
+	}
+}
+
+size_t demo::JsonIndex::build(const char* text, size_t textSize, uint8_t* out, size_t maxEntries)
+{
+	// For each open object or array: the entry its members are filed under,
+	// and whether that entry is its own or that of an array it is inside
+	struct Level
+	{
+		bool object;
+		bool owned;
+		bool indexed; ///< False below a member that got no entry, so that nothing is filed under the wrong parent
+		uint16_t entry;
+	};
+	Level stack[maxDepth];
+	size_t depth = 0;
+
+	if (maxEntries > 0xFFFF) maxEntries = 0xFFFF;
+	size_t count = 0;
+	uint32_t flags = 0;
+
+	Scanner scan{text, textSize, 0};
+	scan.skipSpace();
+	if (!scan.peek('{') && !scan.peek('[')) return 0;
+
+	// Parse a value, then what follows it, until the top level closes
+	for (;;)
+	{
+		// At the start of a value. Inside an object, that is preceded by a key.
+		size_t index = 0xFFFF;
+		Entry entry;
+		memset(&entry, 0, sizeof(entry));
+		scan.skipSpace();
+		if (depth > 0 && stack[depth - 1].object)
+		{
+			size_t keyStart = scan.pos + 1;
+			if (!scan.string()) return 0;
+			size_t keyLength = scan.pos - 1 - keyStart;
+			scan.skipSpace();
+			if (!scan.peek(':')) return 0;
+			++scan.pos;
+			scan.skipSpace();
+
+			if (stack[depth - 1].indexed && count < maxEntries && keyLength <= 0xFFFF)
+			{
+				index = count++;
+				entry.keyOffset = keyStart;
+				entry.keyLength = keyLength;
+				entry.parent = stack[depth - 1].entry;
+			}
+			else if (stack[depth - 1].indexed)
+			{
+				flags |= Truncated;
+			}
+		}
+
+		size_t valueStart = scan.pos;
+		entry.valueOffset = valueStart;
+		char c = scan.pos < textSize ? text[scan.pos] : 0;
+		if (c == '{' || c == '[')
+		{
+			if (depth == maxDepth) return 0;
+			stack[depth].object = c == '{';
+			stack[depth].owned = index != 0xFFFF;
+			if (depth == 0)
+			{
+				stack[depth].indexed = true;
+				stack[depth].entry = noParent;
+			}
+			else if (stack[depth - 1].object)
+			{
+				stack[depth].indexed = index != 0xFFFF;
+				stack[depth].entry = index;
+			}
+			else
+			{
+				stack[depth].indexed = stack[depth - 1].indexed;
+				stack[depth].entry = stack[depth - 1].entry;
+			}
+			++depth;
+			++scan.pos;
+			entry.type = c == '{' ? ValueType::Object : ValueType::Array;
+			if (index != 0xFFFF) putEntry(out, index, entry);
+
+			// An empty object or array closes at once; otherwise its first member follows
+			scan.skipSpace();
+			if (!scan.peek(c == '{' ? '}' : ']')) continue;
+		}
+		else
+		{
+			if (c == '"')
+			{
+				if (!scan.string()) return 0;
+				entry.type = ValueType::String;
+				entry.valueOffset = valueStart + 1;
+				entry.valueLength = scan.pos - valueStart - 2;
+			}
+			else if (c == 't' || c == 'f' || c == 'n')
+			{
+				if (scan.literal("true")) { entry.type = ValueType::True; entry.number = 1; }
+				else if (scan.literal("false")) { entry.type = ValueType::False; }
+				else if (scan.literal("null")) { entry.type = ValueType::Null; }
+				else return 0;
+				entry.valueLength = scan.pos - valueStart;
+			}
+			else
+			{
+				if (!scan.number(entry.number)) return 0;
+				entry.type = ValueType::Number;
+				entry.valueLength = scan.pos - valueStart;
+			}
+			if (index != 0xFFFF) putEntry(out, index, entry);
+			scan.skipSpace();
+		}
+
+		// After a value: another member, or the end of one or more objects and arrays
+		for (;;)
+		{
+			if (scan.peek(','))
+			{
+				++scan.pos;
+				break;
+			}
+			if (!scan.peek(stack[depth - 1].object ? '}' : ']')) return 0;
+			++scan.pos;
+			--depth;
+
+			// Now that its end is known, complete the entry the object or array is the value of
+			if (stack[depth].owned)
+			{
+				uint8_t* closed = out + bytes(stack[depth].entry);
+				uint32_t valueOffset;
+				memcpy(&valueOffset, closed + offsetof(Entry, valueOffset), sizeof(valueOffset));
+				uint32_t valueLength = scan.pos - valueOffset;
+				memcpy(closed + offsetof(Entry, valueLength), &valueLength, sizeof(valueLength));
+			}
+
+			scan.skipSpace();
+			if (depth == 0)
+			{
+				// Nothing but white space may follow the document
+				if (scan.pos != textSize) return 0;
+
+				Header header;
+				header.magic = magic;
+				header.version = 1;
+				header.count = count;
+				header.textSize = textSize;
+				header.flags = flags;
+				memcpy(out, &header, sizeof(header));
+				return bytes(count);
+			}
+		}
+	}
+}
+
+demo::JsonIndex::JsonIndex(const uint8_t* payload, size_t payloadSize)
+	: text_(reinterpret_cast<const char*>(payload))
+	, entries_(nullptr)
+{
+	memset(&header_, 0, sizeof(header_));
+
+	const void* nul = memchr(payload, 0, payloadSize);
+	if (nul == nullptr) return;
+	size_t start = offset(static_cast<const uint8_t*>(nul) - payload);
+	if (start + sizeof(Header) > payloadSize) return;
+
+	Header header;
+	memcpy(&header, payload + start, sizeof(header));
+	if (header.magic != magic || header.version != 1 || header.textSize != static_cast<const uint8_t*>(nul) - payload) return;
+	if (start + bytes(header.count) > payloadSize) return;
+	header_ = header;
+	entries_ = payload + start + sizeof(Header);
+}
+
+demo::JsonIndex::Entry demo::JsonIndex::entry(size_t index) const
+{
+	Entry entry;
+	memcpy(&entry, entries_ + index * sizeof(Entry), sizeof(entry));
+	return entry;
+}
+
+int demo::JsonIndex::find(const char* key, uint16_t parent) const
+{
+	size_t length = strlen(key);
+	for (size_t ii = 0; ii < size(); ++ii)
+	{
+		Entry candidate = entry(ii);
+		if (candidate.parent == parent && candidate.keyLength == length && memcmp(text_ + candidate.keyOffset, key, length) == 0)
+		{
+			return static_cast<int>(ii);
+		}
+	}
+	return -1;
+}
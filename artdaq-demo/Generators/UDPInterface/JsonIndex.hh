@@ -0,0 +1,161 @@
+#ifndef artdaq_demo_Generators_UDPInterface_JsonIndex_hh
+#define artdaq_demo_Generators_UDPInterface_JsonIndex_hh
+
+#include <cstddef>
+#include <cstdint>
+
+namespace demo
+{
+	/**
+	 * \brief A binary index of the members of a JSON document, stored right after its text
+	 *
+	 * UDPReceiver can write one into JSON fragments as they are made, so that
+	 * monitoring code can pick values out without parsing the text again. The
+	 * fragment payload is then
+	 * \verbatim
+	 * the text, then a NUL
+	 * zero padding, up to a multiple of 8 bytes from the start of the text
+	 * a Header
+	 * Header::count Entry records
+	 * \endverbatim
+	 * All fields are in host byte order, and offsets are from the start of the
+	 * text. There is an Entry for every member of every object, in document
+	 * order, up to the number build() was given room for. Array elements have
+	 * no entries of their own, but the members of objects inside arrays do.
+	 *
+	 * Both writing and reading are done in place, without allocating memory.
+	 */
+	class JsonIndex
+	{
+	public:
+		/**
+		 * \brief What kind of value a member has
+		 */
+		enum class ValueType : uint8_t
+		{
+			Null = 0,
+			False = 1,
+			True = 2,
+			Number = 3,
+			String = 4,
+			Object = 5,
+			Array = 6,
+		};
+
+		static const uint32_t magic = 0x3158494A; ///< "JIX1", as the first four bytes of the Header on a little-endian machine
+		static const uint16_t noParent = 0xFFFF; ///< Entry::parent of members of the top-level object
+		static const size_t maxDepth = 64; ///< Most levels of nesting build() accepts
+
+		/**
+		 * \brief Flags in Header::flags
+		 */
+		enum : uint32_t
+		{
+			Truncated = 1, ///< There were more members than room for entries; the first ones are indexed
+		};
+
+		/**
+		 * \brief Start of the index
+		 */
+		struct Header
+		{
+			uint32_t magic; ///< JsonIndex::magic
+			uint16_t version; ///< Layout version, 1
+			uint16_t count; ///< Number of entries
+			uint32_t textSize; ///< Bytes of text, not counting its NUL
+			uint32_t flags; ///< Truncated, or 0
+		};
+
+		/**
+		 * \brief One member of an object
+		 */
+		struct Entry
+		{
+			uint32_t keyOffset; ///< Start of the key, after its opening quote. Escapes are left as they are in the text
+			uint32_t valueOffset; ///< Start of the value; for strings, after the opening quote
+			uint32_t valueLength; ///< Bytes of value text; for strings, without the quotes, and for objects and arrays, including the brackets
+			uint16_t keyLength; ///< Bytes of key, without the quotes
+			uint16_t parent; ///< Index of the entry whose value contains this member, or noParent
+			ValueType type; ///< Kind of value
+			uint8_t reserved[7]; ///< Zero
+			double number; ///< Value of a Number; 1 for True; 0 otherwise
+		};
+
+		/**
+		 * \brief Where the index starts
+		 * \param textSize Bytes of text, not counting its NUL
+		 * \return Offset of the Header from the start of the text
+		 */
+		static size_t offset(size_t textSize) { return (textSize + 1 + 7) & ~size_t(7); }
+
+		/**
+		 * \brief How much room an index needs
+		 * \param entries Number of entries
+		 * \return Size of the Header and entries, in bytes
+		 */
+		static size_t bytes(size_t entries) { return sizeof(Header) + entries * sizeof(Entry); }
+
+		/**
+		 * \brief Scan a JSON document and write its index
+		 * \param text The document, whose top level must be an object or an array. Must be followed by a NUL
+		 * \param textSize Bytes of text, not counting the NUL
+		 * \param out Where to write the index, normally text + offset(textSize). Must have room for bytes(maxEntries)
+		 * \param maxEntries Most entries to write, up to 65535
+		 * \return Bytes of index written, or 0 if the text is not JSON or is nested more than maxDepth deep
+		 */
+		static size_t build(const char* text, size_t textSize, uint8_t* out, size_t maxEntries);
+
+		/**
+		 * \brief Find the index after a NUL-terminated text
+		 * \param payload Start of the text
+		 * \param payloadSize Bytes available from payload, including the index and any padding after it
+		 */
+		JsonIndex(const uint8_t* payload, size_t payloadSize);
+
+		/**
+		 * \brief Whether there is an index after the text
+		 * \return True if one was found
+		 */
+		bool valid() const { return entries_ != nullptr; }
+
+		/**
+		 * \brief Get the number of entries
+		 * \return Number of entries, or 0 if there is no index
+		 */
+		size_t size() const { return header_.count; }
+
+		/**
+		 * \brief Whether some members were left out
+		 * \return True if Truncated is set
+		 */
+		bool truncated() const { return (header_.flags & Truncated) != 0; }
+
+		/**
+		 * \brief Get an entry. Copied out, as the index need not be aligned
+		 * \param index Entry index, less than size()
+		 * \return The entry
+		 */
+		Entry entry(size_t index) const;
+
+		/**
+		 * \brief Find a member by key
+		 * \param key The key, as written in the text
+		 * \param parent Look among the members of this entry's value, or of the top level
+		 * \return Index of the first matching entry, or -1
+		 */
+		int find(const char* key, uint16_t parent = noParent) const;
+
+		/**
+		 * \brief Access the text
+		 * \return The start of the text the offsets are relative to
+		 */
+		const char* text() const { return text_; }
+
+	private:
+		const char* text_;
+		const uint8_t* entries_;
+		Header header_;
+	};
+}
+
+#endif /* artdaq_demo_Generators_UDPInterface_JsonIndex_hh */
@@ -0,0 +1,77 @@
+#ifndef artdaq_demo_Generators_UDPInterface_LatencyHistogram_hh
+#define artdaq_demo_Generators_UDPInterface_LatencyHistogram_hh
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace demo
+{
+	/**
+	 * \brief A histogram of durations with power-of-two bins, cheap enough to fill for every datagram
+	 *
+	 * Bin 0 counts zero; bin b counts durations from 2^(b-1) to 2^b - 1. Percentiles
+	 * are therefore only good to a factor of two, which is plenty to see where
+	 * the time goes.
+	 */
+	class LatencyHistogram
+	{
+	public:
+		/**
+		 * \brief LatencyHistogram Constructor. The histogram starts out empty
+		 */
+		LatencyHistogram() { clear(); }
+
+		/**
+		 * \brief Count one duration
+		 * \param ns The duration, in nanoseconds
+		 */
+		void add(uint64_t ns)
+		{
+			++bins_[ns == 0 ? 0 : 64 - __builtin_clzll(ns)];
+			++count_;
+			max_ = std::max(max_, ns);
+		}
+
+		/**
+		 * \brief Estimate a percentile
+		 * \param fraction The fraction of durations that should be at or below the result, e.g. 0.99
+		 * \return The upper edge of the bin containing that fraction, in nanoseconds, but no more than max(). 0 if the histogram is empty
+		 */
+		uint64_t percentile(double fraction) const
+		{
+			uint64_t wanted = static_cast<uint64_t>(fraction * count_ + 0.5);
+			uint64_t seen = 0;
+			for (size_t bin = 0; bin < bins_.size(); ++bin)
+			{
+				seen += bins_[bin];
+				if (seen >= wanted && seen > 0)
+				{
+					return bin == 0 ? 0 : std::min(max_, (uint64_t(2) << (bin - 1)) - 1);
+				}
+			}
+			return max_;
+		}
+
+		uint64_t count() const { return count_; } ///< Number of durations counted
+		uint64_t max() const { return max_; } ///< Longest duration counted, in nanoseconds
+
+		/**
+		 * \brief Forget everything counted
+		 */
+		void clear()
+		{
+			bins_.fill(0);
+			count_ = 0;
+			max_ = 0;
+		}
+
+	private:
+		std::array<uint64_t, 65> bins_;
+		uint64_t count_;
+		uint64_t max_;
+	};
+}
+
+#endif /* artdaq_demo_Generators_UDPInterface_LatencyHistogram_hh */
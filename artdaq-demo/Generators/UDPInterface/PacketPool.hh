@@ -0,0 +1,142 @@
+#ifndef artdaq_demo_Generators_UDPInterface_PacketPool_hh
+#define artdaq_demo_Generators_UDPInterface_PacketPool_hh
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace demo
+{
+	/**
+	 * \brief A preallocated slab of fixed-size receive slots, each holding one or more datagrams
+	 *
+	 * Datagrams are received directly into slots and stay there until they have
+	 * been copied into a Fragment. Normally a slot holds one datagram. With UDP
+	 * generic receive offload, the kernel hands over several datagrams of one
+	 * flow in a single buffer, so a slot may hold up to segments() of them, one
+	 * after another.
+	 *
+	 * Each datagram is addressed by a packet index, which names its slot and its
+	 * place in the slot, and has a SlotHeader of its own. A slot is in use until
+	 * every datagram in it has been released. Which thread owns which slot or
+	 * packet is managed by the user, typically by passing indices through
+	 * SPSCRings.
+	 */
+	class PacketPool
+	{
+	public:
+		static const uint32_t npos = 0xFFFFFFFF; ///< Index meaning "no slot" or "no packet"
+
+		/**
+		 * \brief Per-datagram bookkeeping, kept apart from the data so that the data stays contiguous
+		 */
+		struct SlotHeader
+		{
+			uint32_t size; ///< Number of bytes of datagram
+			uint32_t offset; ///< Where the datagram starts in its slot, in bytes
+			uint32_t sourceAddress; ///< IPv4 address of the sender, in network byte order
+			uint16_t sourcePort; ///< UDP port of the sender, in host byte order
+			uint64_t kernelTime; ///< When the kernel received the datagram, in ns since the epoch, or 0 if not known
+			uint64_t receiveTime; ///< When the datagram was taken from the socket, in ns since the epoch
+		};
+
+		/**
+		 * \brief PacketPool Constructor
+		 * \param slots Number of slots
+		 * \param slotBytes Size of each slot, in bytes
+		 * \param segments Most datagrams one slot can hold. Rounded up to a power of two
+		 */
+		PacketPool(size_t slots, size_t slotBytes, size_t segments = 1)
+			: slotBytes_(slotBytes)
+			, segmentShift_(0)
+			, slab_(slots * slotBytes)
+			, refs_(slots, 0)
+		{
+			while ((size_t(1) << segmentShift_) < segments) ++segmentShift_;
+			headers_.assign(slots << segmentShift_, SlotHeader{0, 0, 0, 0, 0, 0});
+		}
+
+		/**
+		 * \brief Get the number of slots
+		 * \return The number of slots in the pool
+		 */
+		size_t slots() const { return refs_.size(); }
+
+		/**
+		 * \brief Get the size of a slot
+		 * \return The size of each slot, in bytes
+		 */
+		size_t slotBytes() const { return slotBytes_; }
+
+		/**
+		 * \brief Get the number of datagrams a slot can hold
+		 * \return The number of packet indices per slot
+		 */
+		size_t segments() const { return size_t(1) << segmentShift_; }
+
+		/**
+		 * \brief Get the number of packet indices
+		 * \return slots() * segments()
+		 */
+		size_t packets() const { return headers_.size(); }
+
+		/**
+		 * \brief Get the index of a datagram in a slot
+		 * \param slot Slot index
+		 * \param segment Which datagram of the slot, from 0 to segments() - 1
+		 * \return The packet index
+		 */
+		uint32_t packet(uint32_t slot, size_t segment) const { return (slot << segmentShift_) | static_cast<uint32_t>(segment); }
+
+		/**
+		 * \brief Get the slot a datagram is in
+		 * \param packet Packet index
+		 * \return The slot index
+		 */
+		uint32_t slotOf(uint32_t packet) const { return packet >> segmentShift_; }
+
+		/**
+		 * \brief Access the memory of a slot
+		 * \param slot Slot index
+		 * \return Pointer to the first byte of the slot
+		 */
+		uint8_t* slotData(uint32_t slot) { return &slab_[slot * slotBytes_]; }
+
+		/**
+		 * \brief Access a datagram
+		 * \param packet Packet index
+		 * \return Pointer to the first byte of the datagram
+		 */
+		uint8_t* data(uint32_t packet) { return slotData(slotOf(packet)) + headers_[packet].offset; }
+
+		/**
+		 * \brief Access the header of a datagram
+		 * \param packet Packet index
+		 * \return Reference to the datagram's header
+		 */
+		SlotHeader& header(uint32_t packet) { return headers_[packet]; }
+
+		/**
+		 * \brief Record how many datagrams a slot was filled with, before handing them over
+		 * \param slot Slot index
+		 * \param count Number of datagrams, each of which must be released
+		 */
+		void hold(uint32_t slot, uint32_t count) { refs_[slot] = count; }
+
+		/**
+		 * \brief Release one datagram of a slot. Only the thread the datagrams were handed to may call this
+		 * \param slot Slot index
+		 * \return Whether that was the last one, so that the slot is free again
+		 */
+		bool release(uint32_t slot) { return --refs_[slot] == 0; }
+
+	private:
+		size_t slotBytes_;
+		unsigned segmentShift_;
+		std::vector<uint8_t> slab_;
+		std::vector<uint32_t> refs_;
+		std::vector<SlotHeader> headers_;
+	};
+}
+
+#endif /* artdaq_demo_Generators_UDPInterface_PacketPool_hh */
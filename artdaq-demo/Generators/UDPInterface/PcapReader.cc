@@ -0,0 +1,400 @@
+#include "artdaq-demo/Generators/UDPInterface/PcapReader.hh"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace
+{
+	// Magic numbers, as read in the byte order of the machine that wrote the file
+	const uint32_t pcapMagicMicro = 0xA1B2C3D4;
+	const uint32_t pcapMagicNano = 0xA1B23C4D;
+
+	// pcapng block types, and the byte-order magic of the section header
+	const uint32_t blockSectionHeader = 0x0A0D0D0A;
+	const uint32_t blockInterface = 1;
+	const uint32_t blockSimplePacket = 3;
+	const uint32_t blockEnhancedPacket = 6;
+	const uint32_t byteOrderMagic = 0x1A2B3C4D;
+
+	// pcapng interface options
+	const uint16_t optionEnd = 0;
+	const uint16_t optionTimestampResolution = 9;
+	const uint16_t optionTimestampOffset = 14;
+
+	// Link types we can find IPv4 in
+	const uint16_t linkNull = 0;
+	const uint16_t linkEthernet = 1;
+	const uint16_t linkRaw = 101;
+	const uint16_t linkLinuxSLL = 113;
+	const uint16_t linkIPv4 = 228;
+	const uint16_t linkLinuxSLL2 = 276;
+
+	// Far bigger than any frame we can use; anything larger means the file is corrupt
+	const size_t maxRecordBytes = 16 << 20;
+
+	uint16_t be16(const uint8_t* data) { return uint16_t(data[0] << 8 | data[1]); }
+}
+
+demo::PcapReader::PcapReader()
+	: file_(nullptr)
+	, ng_(false)
+	, swapped_(false)
+	, skipped_(0)
+{
+}
+
+demo::PcapReader::~PcapReader()
+{
+	close();
+}
+
+bool demo::PcapReader::open(std::string const& path)
+{
+	close();
+	error_.clear();
+	skipped_ = 0;
+	interfaces_.clear();
+
+	file_ = fopen(path.c_str(), "rb");
+	if (file_ == nullptr)
+	{
+		return fail_("Cannot open " + path + ": " + strerror(errno));
+	}
+
+	uint32_t magic;
+	if (!read_(&magic, sizeof(magic)))
+	{
+		return fail_(path + " is too short to be a capture file");
+	}
+
+	// A pcapng file starts with a section header block, which nextBlock_
+	// reads like any other
+	if (magic == blockSectionHeader)
+	{
+		ng_ = true;
+		rewind(file_);
+		return true;
+	}
+
+	ng_ = false;
+	swapped_ = magic == __builtin_bswap32(pcapMagicMicro) || magic == __builtin_bswap32(pcapMagicNano);
+	if (swapped_) magic = __builtin_bswap32(magic);
+	if (magic != pcapMagicMicro && magic != pcapMagicNano)
+	{
+		return fail_(path + " is not a pcap or pcapng file");
+	}
+
+	// Version, time zone, timestamp accuracy, snap length, link type
+	uint8_t header[20];
+	if (!read_(header, sizeof(header)))
+	{
+		return fail_(path + " has a truncated file header");
+	}
+	Interface interface;
+	interface.linkType = uint16_t(get32_(header + 16));
+	interface.unitsPerSecond = magic == pcapMagicNano ? 1000000000 : 1000000;
+	interface.shift = 0;
+	interface.offsetSeconds = 0;
+	interfaces_.push_back(interface);
+	return true;
+}
+
+bool demo::PcapReader::next(Datagram& datagram)
+{
+	if (file_ == nullptr) return false;
+	return ng_ ? nextBlock_(datagram) : nextClassic_(datagram);
+}
+
+void demo::PcapReader::close()
+{
+	if (file_ != nullptr)
+	{
+		fclose(file_);
+		file_ = nullptr;
+	}
+}
+
+bool demo::PcapReader::read_(void* data, size_t size)
+{
+	return fread(data, 1, size, file_) == size;
+}
+
+bool demo::PcapReader::fail_(std::string const& message)
+{
+	error_ = message;
+	close();
+	return false;
+}
+
+uint16_t demo::PcapReader::get16_(const uint8_t* data) const
+{
+	uint16_t value;
+	memcpy(&value, data, sizeof(value));
+	return swapped_ ? __builtin_bswap16(value) : value;
+}
+
+uint32_t demo::PcapReader::get32_(const uint8_t* data) const
+{
+	uint32_t value;
+	memcpy(&value, data, sizeof(value));
+	return swapped_ ? __builtin_bswap32(value) : value;
+}
+
+bool demo::PcapReader::nextClassic_(Datagram& datagram)
+{
+	for (;;)
+	{
+		// Seconds, fraction of a second, captured length, original length
+		uint8_t header[16];
+		size_t got = fread(header, 1, sizeof(header), file_);
+		if (got == 0 && feof(file_)) return false;
+		if (got != sizeof(header))
+		{
+			return fail_("Truncated record header");
+		}
+
+		size_t captured = get32_(header + 8);
+		size_t original = get32_(header + 12);
+		if (captured > maxRecordBytes)
+		{
+			return fail_("Record of " + std::to_string(captured) + " bytes; the file is corrupt");
+		}
+		buffer_.resize(captured);
+		if (!read_(buffer_.data(), captured))
+		{
+			return fail_("Truncated record");
+		}
+
+		Interface const& interface = interfaces_.front();
+		uint64_t ticks = uint64_t(get32_(header)) * interface.unitsPerSecond + get32_(header + 4);
+		if (decode_(interface, ticks, captured, original, datagram)) return true;
+	}
+}
+
+bool demo::PcapReader::nextBlock_(Datagram& datagram)
+{
+	for (;;)
+	{
+		// Block type and total length, which counts these and the copy of the
+		// length at the end
+		uint8_t header[8];
+		size_t got = fread(header, 1, sizeof(header), file_);
+		if (got == 0 && feof(file_)) return false;
+		if (got != sizeof(header))
+		{
+			return fail_("Truncated block header");
+		}
+
+		uint32_t type;
+		memcpy(&type, header, sizeof(type));
+		size_t consumed = sizeof(header);
+		if (type == blockSectionHeader)
+		{
+			// Each section has its own byte order, and its own interfaces
+			uint32_t magic;
+			if (!read_(&magic, sizeof(magic)))
+			{
+				return fail_("Truncated section header");
+			}
+			if (magic != byteOrderMagic && magic != __builtin_bswap32(byteOrderMagic))
+			{
+				return fail_("Bad byte-order magic in section header");
+			}
+			swapped_ = magic != byteOrderMagic;
+			interfaces_.clear();
+			consumed += sizeof(magic);
+		}
+		type = get32_(header);
+
+		size_t length = get32_(header + 4);
+		if (length < consumed + 4 || length % 4 != 0 || length > maxRecordBytes)
+		{
+			return fail_("Block of " + std::to_string(length) + " bytes; the file is corrupt");
+		}
+		buffer_.resize(length - consumed);
+		if (!read_(buffer_.data(), buffer_.size()))
+		{
+			return fail_("Truncated block");
+		}
+		size_t bodySize = buffer_.size() - 4;
+		const uint8_t* body = buffer_.data();
+
+		if (type == blockInterface)
+		{
+			readInterface_(bodySize);
+		}
+		else if (type == blockEnhancedPacket && bodySize >= 20)
+		{
+			// Interface, timestamp (high and low words), captured length, original length
+			uint32_t index = get32_(body);
+			size_t captured = get32_(body + 12);
+			size_t original = get32_(body + 16);
+			if (index >= interfaces_.size() || 20 + captured > bodySize)
+			{
+				++skipped_;
+				continue;
+			}
+			uint64_t ticks = uint64_t(get32_(body + 4)) << 32 | get32_(body + 8);
+			memmove(buffer_.data(), body + 20, captured);
+			if (decode_(interfaces_[index], ticks, captured, original, datagram)) return true;
+		}
+		else if (type == blockSimplePacket && bodySize >= 4 && !interfaces_.empty())
+		{
+			// Original length, then as much of the frame as was captured. There
+			// is no timestamp.
+			size_t original = get32_(body);
+			size_t captured = std::min(original, bodySize - 4);
+			memmove(buffer_.data(), body + 4, captured);
+			if (decode_(interfaces_.front(), 0, captured, original, datagram))
+			{
+				datagram.time = 0;
+				return true;
+			}
+		}
+		// Anything else (statistics, name resolution, custom blocks) is of no interest
+	}
+}
+
+void demo::PcapReader::readInterface_(size_t bodySize)
+{
+	Interface interface;
+	interface.linkType = bodySize >= 2 ? get16_(buffer_.data()) : 0xFFFF;
+	interface.unitsPerSecond = 1000000;
+	interface.shift = 0;
+	interface.offsetSeconds = 0;
+
+	// Link type, reserved, snap length, then options, each padded to four bytes
+	for (size_t pos = 8; pos + 4 <= bodySize;)
+	{
+		const uint8_t* option = buffer_.data() + pos;
+		uint16_t code = get16_(option);
+		size_t length = get16_(option + 2);
+		if (code == optionEnd || pos + 4 + length > bodySize) break;
+		if (code == optionTimestampResolution && length >= 1)
+		{
+			// Negative power of ten, or, with the high bit set, of two
+			uint8_t resolution = option[4];
+			if (resolution & 0x80)
+			{
+				interface.unitsPerSecond = 0;
+				interface.shift = std::min(resolution & 0x7F, 63);
+			}
+			else
+			{
+				interface.unitsPerSecond = 1;
+				for (unsigned ii = 0; ii < std::min(unsigned(resolution), 18u); ++ii) interface.unitsPerSecond *= 10;
+			}
+		}
+		else if (code == optionTimestampOffset && length >= 8)
+		{
+			uint64_t offset;
+			memcpy(&offset, option + 4, sizeof(offset));
+			interface.offsetSeconds = int64_t(swapped_ ? __builtin_bswap64(offset) : offset);
+		}
+		pos += 4 + (length + 3) / 4 * 4;
+	}
+	interfaces_.push_back(interface);
+}
+
+bool demo::PcapReader::decode_(Interface const& interface, uint64_t ticks, size_t captured, size_t original, Datagram& datagram)
+{
+	const uint8_t* frame = buffer_.data();
+
+	// A frame cut short by the snap length is no use to anyone
+	if (captured < original)
+	{
+		++skipped_;
+		return false;
+	}
+
+	// Find the IPv4 header
+	size_t ip = 0;
+	bool ipv4 = false;
+	switch (interface.linkType)
+	{
+	case linkNull:
+		// Address family, in the byte order of the machine that captured it
+		ip = 4;
+		ipv4 = captured >= 4 && (memcmp(frame, "\x02\0\0\0", 4) == 0 || memcmp(frame, "\0\0\0\x02", 4) == 0);
+		break;
+	case linkEthernet:
+		ip = 14;
+		if (captured < ip) break;
+		while ((be16(frame + ip - 2) == 0x8100 || be16(frame + ip - 2) == 0x88A8) && captured >= ip + 4) ip += 4;
+		ipv4 = be16(frame + ip - 2) == 0x0800;
+		break;
+	case linkRaw:
+	case linkIPv4:
+		ip = 0;
+		ipv4 = true;
+		break;
+	case linkLinuxSLL:
+		ip = 16;
+		ipv4 = captured >= ip && be16(frame + 14) == 0x0800;
+		break;
+	case linkLinuxSLL2:
+		ip = 20;
+		ipv4 = captured >= ip && be16(frame) == 0x0800;
+		break;
+	}
+
+	if (!ipv4 || captured < ip + 20 || frame[ip] >> 4 != 4 || frame[ip + 9] != 17)
+	{
+		++skipped_;
+		return false;
+	}
+	size_t headerLength = (frame[ip] & 0xF) * 4;
+	size_t totalLength = be16(frame + ip + 2);
+
+	// Fragments would have to be reassembled; more fragments flag or an offset
+	bool fragment = (be16(frame + ip + 6) & 0x3FFF) != 0;
+	if (fragment || headerLength < 20 || totalLength < headerLength + 8 || ip + totalLength > captured)
+	{
+		++skipped_;
+		return false;
+	}
+
+	const uint8_t* udp = frame + ip + headerLength;
+	size_t udpLength = be16(udp + 4);
+	if (udpLength < 8 || udpLength > totalLength - headerLength)
+	{
+		++skipped_;
+		return false;
+	}
+
+	memcpy(&datagram.sourceAddress, frame + ip + 12, sizeof(datagram.sourceAddress));
+	datagram.sourcePort = be16(udp);
+	datagram.destinationPort = be16(udp + 2);
+	datagram.data = udp + 8;
+	datagram.size = udpLength - 8;
+	datagram.time = toNs_(interface, ticks);
+	return true;
+}
+
+uint64_t demo::PcapReader::toNs_(Interface const& interface, uint64_t ticks) const
+{
+	uint64_t ns;
+	if (interface.unitsPerSecond == 0)
+	{
+		// Whole seconds, then the fraction, keeping the product in 64 bits
+		unsigned shift = interface.shift;
+		uint64_t fraction = ticks & ((uint64_t(1) << shift) - 1);
+		ns = (ticks >> shift) * 1000000000;
+		if (shift > 34)
+		{
+			fraction >>= shift - 34;
+			shift = 34;
+		}
+		ns += fraction * 1000000000 >> shift;
+	}
+	else if (interface.unitsPerSecond >= 1000000000)
+	{
+		ns = ticks / (interface.unitsPerSecond / 1000000000);
+	}
+	else
+	{
+		ns = ticks * (1000000000 / interface.unitsPerSecond);
+	}
+	return ns + uint64_t(interface.offsetSeconds) * 1000000000;
+}
@@ -0,0 +1,104 @@
+#ifndef artdaq_demo_Generators_UDPInterface_PcapReader_hh
+#define artdaq_demo_Generators_UDPInterface_PcapReader_hh
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace demo
+{
+	/**
+	 * \brief Reads the UDP datagrams out of a packet capture file
+	 *
+	 * Both the classic pcap format (microsecond or nanosecond timestamps,
+	 * either byte order) and pcapng are understood. Frames may be Ethernet
+	 * (with or without VLAN tags), raw IPv4, BSD loopback or Linux cooked
+	 * captures, which covers what tcpdump and Wireshark write on Linux.
+	 *
+	 * Only whole, unfragmented IPv4 UDP datagrams are returned. Anything else,
+	 * including frames cut short by the capture's snap length, is skipped and
+	 * counted.
+	 */
+	class PcapReader
+	{
+	public:
+		/**
+		 * \brief One UDP datagram from the capture
+		 */
+		struct Datagram
+		{
+			const uint8_t* data; ///< UDP payload. Valid until the next call to next()
+			size_t size; ///< Bytes of UDP payload
+			uint32_t sourceAddress; ///< IPv4 address of the sender, in network byte order
+			uint16_t sourcePort; ///< UDP port of the sender, in host byte order
+			uint16_t destinationPort; ///< UDP port the datagram was sent to, in host byte order
+			uint64_t time; ///< When the datagram was captured, in ns since the epoch
+		};
+
+		/**
+		 * \brief PcapReader Constructor
+		 */
+		PcapReader();
+
+		/**
+		 * \brief PcapReader Destructor. Calls close()
+		 */
+		~PcapReader();
+
+		/**
+		 * \brief Open a capture file and read its header
+		 * \param path Path of the file
+		 * \return False if the file can't be opened or isn't a capture file we understand; see error()
+		 */
+		bool open(std::string const& path);
+
+		/**
+		 * \brief Read the next UDP datagram
+		 * \param datagram Filled in with the datagram
+		 * \return False at the end of the file, or on error; see error()
+		 */
+		bool next(Datagram& datagram);
+
+		/**
+		 * \brief Close the file
+		 */
+		void close();
+
+		std::string const& error() const { return error_; } ///< Why open() or next() failed, or empty
+		uint64_t skipped() const { return skipped_; } ///< Frames that were not whole IPv4 UDP datagrams
+
+	private:
+		struct Interface
+		{
+			uint16_t linkType;
+			uint64_t unitsPerSecond; ///< Timestamp resolution; 0 means a power of two, given by shift
+			unsigned shift;
+			int64_t offsetSeconds;
+		};
+
+		PcapReader(PcapReader const&) = delete;
+		PcapReader& operator=(PcapReader const&) = delete;
+
+		bool read_(void* data, size_t size);
+		bool fail_(std::string const& message);
+		uint16_t get16_(const uint8_t* data) const;
+		uint32_t get32_(const uint8_t* data) const;
+		bool nextClassic_(Datagram& datagram);
+		bool nextBlock_(Datagram& datagram);
+		void readInterface_(size_t bodySize);
+		bool decode_(Interface const& interface, uint64_t ticks, size_t captured, size_t original, Datagram& datagram);
+		uint64_t toNs_(Interface const& interface, uint64_t ticks) const;
+
+		FILE* file_;
+		bool ng_; ///< pcapng rather than classic pcap
+		bool swapped_; ///< File (or current pcapng section) is in the other byte order
+		std::vector<Interface> interfaces_; ///< For classic pcap, the one link type of the file
+		std::vector<uint8_t> buffer_;
+		std::string error_;
+		uint64_t skipped_;
+	};
+}
+
+#endif /* artdaq_demo_Generators_UDPInterface_PcapReader_hh */
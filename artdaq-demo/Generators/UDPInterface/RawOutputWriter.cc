@@ -0,0 +1,233 @@
+#include "artdaq-demo/Generators/UDPInterface/RawOutputWriter.hh"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+	// O_DIRECT needs buffers, sizes and file offsets aligned to the logical
+	// block size of the device; a page is enough for anything we will meet.
+	const size_t alignment = 4096;
+
+	// A partly filled buffer is written anyway once it is this old, so that
+	// the file doesn't lag far behind when data is slow
+	const std::chrono::seconds flushInterval(1);
+}
+
+demo::RawOutputWriter::RawOutputWriter(size_t bufferBytes, size_t buffers, bool direct, uint64_t maxFileBytes)
+	: bufferBytes_((std::max(bufferBytes, size_t(1)) + alignment - 1) / alignment * alignment)
+	, direct_(direct)
+	, maxFileBytes_(maxFileBytes)
+	, current_{nullptr, 0}
+	, stopping_(false)
+	, fd_(-1)
+	, fileDirect_(false)
+	, fileIndex_(0)
+	, fileBytes_(0)
+	, written_(0)
+	, dropped_(0)
+{
+	for (size_t ii = 0; ii < std::max(buffers, size_t(2)); ++ii)
+	{
+		void* memory = nullptr;
+		if (posix_memalign(&memory, alignment, bufferBytes_) != 0) throw std::bad_alloc();
+		storage_.push_back(static_cast<uint8_t*>(memory));
+	}
+	free_ = storage_;
+}
+
+demo::RawOutputWriter::~RawOutputWriter()
+{
+	close();
+	for (auto buffer : storage_)
+	{
+		free(buffer);
+	}
+}
+
+bool demo::RawOutputWriter::open(std::string const& basePath)
+{
+	close();
+	basePath_ = basePath;
+	fileIndex_ = 0;
+
+	// Never overwrite the files of an earlier run
+	if (maxFileBytes_ > 0)
+	{
+		while (access((basePath_ + "-" + std::to_string(fileIndex_) + ".bin").c_str(), F_OK) == 0)
+		{
+			++fileIndex_;
+		}
+	}
+
+	if (!openFile_()) return false;
+	thread_ = std::thread(&RawOutputWriter::writerLoop_, this);
+	return true;
+}
+
+void demo::RawOutputWriter::write(const void* data, size_t size)
+{
+	if (!thread_.joinable()) return;
+
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	while (size > 0)
+	{
+		if (current_.data == nullptr)
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			if (free_.empty())
+			{
+				// The disk is behind. Don't hold up the caller; lose the data.
+				dropped_ += size;
+				return;
+			}
+			current_.data = free_.back();
+			current_.size = 0;
+			free_.pop_back();
+			currentStarted_ = std::chrono::steady_clock::now();
+		}
+
+		size_t count = std::min(size, bufferBytes_ - current_.size);
+		memcpy(current_.data + current_.size, bytes, count);
+		current_.size += count;
+		bytes += count;
+		size -= count;
+
+		if (current_.size == bufferBytes_) submit_();
+	}
+
+	// Partial buffers would spoil the alignment O_DIRECT needs, so only flush
+	// them early when it is off
+	if (!direct_ && current_.data != nullptr && std::chrono::steady_clock::now() - currentStarted_ >= flushInterval)
+	{
+		submit_();
+	}
+}
+
+void demo::RawOutputWriter::close()
+{
+	if (!thread_.joinable()) return;
+
+	if (current_.data != nullptr && current_.size > 0) submit_();
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		stopping_ = true;
+	}
+	cv_.notify_one();
+	thread_.join();
+	stopping_ = false;
+
+	if (current_.data != nullptr)
+	{
+		free_.push_back(current_.data);
+		current_.data = nullptr;
+	}
+	closeFile_();
+}
+
+void demo::RawOutputWriter::submit_()
+{
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		full_.push_back(current_);
+	}
+	cv_.notify_one();
+	current_.data = nullptr;
+	current_.size = 0;
+}
+
+void demo::RawOutputWriter::writerLoop_()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (true)
+	{
+		cv_.wait(lock, [this] { return stopping_ || !full_.empty(); });
+		if (full_.empty()) break;
+
+		Buffer buffer = full_.front();
+		full_.pop_front();
+		lock.unlock();
+		writeBuffer_(buffer);
+		lock.lock();
+		free_.push_back(buffer.data);
+	}
+}
+
+void demo::RawOutputWriter::writeBuffer_(Buffer const& buffer)
+{
+	if (maxFileBytes_ > 0 && fileBytes_ > 0 && fileBytes_ + buffer.size > maxFileBytes_)
+	{
+		closeFile_();
+		++fileIndex_;
+		openFile_();
+	}
+	if (fd_ < 0)
+	{
+		dropped_ += buffer.size;
+		return;
+	}
+
+	// With O_DIRECT, only whole blocks can be written. A short last buffer is
+	// written through the page cache, which ends O_DIRECT for this file.
+	size_t aligned = fileDirect_ ? buffer.size / alignment * alignment : buffer.size;
+	size_t done = 0;
+	while (done < buffer.size)
+	{
+		if (done == aligned && fileDirect_)
+		{
+			fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) & ~O_DIRECT);
+			fileDirect_ = false;
+			aligned = buffer.size;
+		}
+
+		ssize_t count = ::write(fd_, buffer.data + done, aligned - done);
+		if (count < 0)
+		{
+			if (errno == EINTR) continue;
+			dropped_ += buffer.size - done;
+			break;
+		}
+		done += count;
+	}
+	written_ += done;
+	fileBytes_ += done;
+}
+
+bool demo::RawOutputWriter::openFile_()
+{
+	std::string path = maxFileBytes_ > 0 ? basePath_ + "-" + std::to_string(fileIndex_) + ".bin" : basePath_ + ".bin";
+	int flags = O_WRONLY | O_CREAT | O_APPEND;
+
+	fileDirect_ = direct_;
+	fd_ = ::open(path.c_str(), flags | (fileDirect_ ? O_DIRECT : 0), 0644);
+	if (fd_ < 0 && fileDirect_ && errno == EINVAL)
+	{
+		// The filesystem doesn't do O_DIRECT (tmpfs, for one)
+		fileDirect_ = false;
+		fd_ = ::open(path.c_str(), flags, 0644);
+	}
+	if (fd_ < 0) return false;
+
+	struct stat info;
+	fileBytes_ = fstat(fd_, &info) == 0 ? info.st_size : 0;
+	if (fileDirect_ && fileBytes_ % alignment != 0)
+	{
+		// Appending to a file of odd size; the offsets will never line up
+		fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) & ~O_DIRECT);
+		fileDirect_ = false;
+	}
+	return true;
+}
+
+void demo::RawOutputWriter::closeFile_()
+{
+	if (fd_ < 0) return;
+	::close(fd_);
+	fd_ = -1;
+}
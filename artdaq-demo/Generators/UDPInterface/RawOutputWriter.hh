@@ -0,0 +1,119 @@
+#ifndef artdaq_demo_Generators_UDPInterface_RawOutputWriter_hh
+#define artdaq_demo_Generators_UDPInterface_RawOutputWriter_hh
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace demo
+{
+	/**
+	 * \brief Writes a stream of bytes to disk from a thread of its own
+	 *
+	 * write() copies data into large, page-aligned buffers. Full buffers are
+	 * queued for the writer thread, which keeps the output file open for as
+	 * long as the writer is. If the disk can't keep up and every buffer is
+	 * queued, data is dropped and counted, rather than making the caller wait.
+	 *
+	 * Optionally the file is opened with O_DIRECT, so that the data doesn't go
+	 * through the page cache, and a new file is started whenever the current
+	 * one would grow past a given size.
+	 */
+	class RawOutputWriter
+	{
+	public:
+		/**
+		 * \brief RawOutputWriter Constructor
+		 * \param bufferBytes Size of each buffer. Rounded up to a multiple of the page size
+		 * \param buffers Number of buffers. At least two
+		 * \param direct Whether to open the file with O_DIRECT
+		 * \param maxFileBytes Size at which to start a new file, or 0 to write one file
+		 */
+		RawOutputWriter(size_t bufferBytes, size_t buffers, bool direct, uint64_t maxFileBytes);
+
+		/**
+		 * \brief RawOutputWriter Destructor. Calls close()
+		 */
+		~RawOutputWriter();
+
+		/**
+		 * \brief Open the output file and start the writer thread
+		 * \param basePath Path of the output file, without the ".bin" extension
+		 * \return False, with errno set, if the file can't be opened
+		 *
+		 * Without rotation, data is appended to basePath.bin. With rotation, the
+		 * files are basePath-N.bin, starting from the lowest N not already used.
+		 */
+		bool open(std::string const& basePath);
+
+		/**
+		 * \brief Queue data to be written
+		 * \param data Start of the data
+		 * \param size Size of the data, in bytes
+		 */
+		void write(const void* data, size_t size);
+
+		/**
+		 * \brief Write everything queued, stop the writer thread and close the file
+		 */
+		void close();
+
+		/**
+		 * \brief Whether the writer is open
+		 * \return True between a successful open() and close()
+		 */
+		bool isOpen() const { return thread_.joinable(); }
+
+		uint64_t written() const { return written_.load(); } ///< Bytes written to disk
+		uint64_t dropped() const { return dropped_.load(); } ///< Bytes dropped, because no buffer was free or the write failed
+
+	private:
+		struct Buffer
+		{
+			uint8_t* data;
+			size_t size;
+		};
+
+		RawOutputWriter(RawOutputWriter const&) = delete;
+		RawOutputWriter& operator=(RawOutputWriter const&) = delete;
+
+		void submit_();
+		void writerLoop_();
+		void writeBuffer_(Buffer const& buffer);
+		bool openFile_();
+		void closeFile_();
+
+		size_t bufferBytes_;
+		bool direct_;
+		uint64_t maxFileBytes_;
+
+		std::vector<uint8_t*> storage_;
+		Buffer current_; ///< Buffer being filled by write(); data is null if none was free
+		std::chrono::steady_clock::time_point currentStarted_;
+
+		std::mutex mutex_;
+		std::condition_variable cv_;
+		std::deque<Buffer> full_; ///< Waiting to be written
+		std::vector<uint8_t*> free_; ///< Ready to be filled
+		bool stopping_;
+		std::thread thread_;
+
+		std::string basePath_;
+		int fd_;
+		bool fileDirect_; ///< Whether fd_ is currently in O_DIRECT mode
+		unsigned fileIndex_;
+		uint64_t fileBytes_;
+
+		std::atomic<uint64_t> written_;
+		std::atomic<uint64_t> dropped_;
+	};
+}
+
+#endif /* artdaq_demo_Generators_UDPInterface_RawOutputWriter_hh */
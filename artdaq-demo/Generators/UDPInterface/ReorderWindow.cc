@@ -0,0 +1,164 @@
+#include "artdaq-demo/Generators/UDPInterface/ReorderWindow.hh"
+
+#include <algorithm>
+
+const size_t demo::ReorderWindow::maxSize;
+const uint8_t demo::ReorderWindow::BurstStart;
+const uint8_t demo::ReorderWindow::BurstEnd;
+
+demo::ReorderWindow::ReorderWindow(size_t size, uint32_t sequenceMask, size_t maxBurst)
+	: size_(std::min(std::max(size, size_t(1)), std::min(maxSize, (size_t(sequenceMask) + 1) / 2)))
+	, mask_(sequenceMask)
+	, maxBurst_(maxBurst)
+	, started_(false)
+	, head_(0)
+	, occupied_(0)
+	, lateRun_(0)
+	, complete_(false)
+	, lost_(0)
+	, late_(0)
+	, duplicates_(0)
+	, discarded_(0)
+	, abandoned_(0)
+{
+	burst_.reserve(maxSize);
+	released_.reserve(maxSize);
+}
+
+demo::ReorderWindow::Result demo::ReorderWindow::insert(uint32_t sequence, uint32_t handle, uint8_t flags)
+{
+	sequence &= mask_;
+	if (!started_)
+	{
+		started_ = true;
+		head_ = sequence;
+	}
+
+	uint32_t distance = (sequence - head_) & mask_;
+	if (distance > mask_ / 2)
+	{
+		// Behind the window. A long run of these means that the sender has
+		// started again from a lower sequence number, so follow it.
+		++late_;
+		if (++lateRun_ < size_) return Result::Late;
+		restart_(sequence);
+		distance = 0;
+	}
+	lateRun_ = 0;
+
+	if (distance >= size_)
+	{
+		if (occupied_ != 0) return Result::Overflow;
+
+		// Nothing is waiting, so just jump ahead
+		lost_ += distance;
+		discardBurst_();
+		head_ = sequence;
+	}
+
+	size_t index = index_(sequence);
+	uint64_t bit = uint64_t(1) << index;
+	if (occupied_ & bit)
+	{
+		++duplicates_;
+		return Result::Duplicate;
+	}
+	occupied_ |= bit;
+	entries_[index].handle = handle;
+	entries_[index].flags = flags;
+	return Result::Inserted;
+}
+
+bool demo::ReorderWindow::nextBurst()
+{
+	while (!complete_)
+	{
+		size_t index = index_(head_);
+		uint64_t bit = uint64_t(1) << index;
+		if (!(occupied_ & bit)) return false;
+
+		occupied_ &= ~bit;
+		head_ = (head_ + 1) & mask_;
+		Entry const& entry = entries_[index];
+
+		if (entry.flags & BurstStart)
+		{
+			// The previous burst never ended
+			discardBurst_();
+		}
+		else if (burst_.empty())
+		{
+			// The rest of a burst whose start was lost
+			++discarded_;
+			released_.push_back(entry.handle);
+			continue;
+		}
+
+		burst_.push_back(entry.handle);
+		complete_ = (entry.flags & BurstEnd) != 0;
+		if (!complete_ && maxBurst_ != 0 && burst_.size() >= maxBurst_)
+		{
+			abandonBurst();
+		}
+	}
+	return true;
+}
+
+bool demo::ReorderWindow::abandonBurst()
+{
+	if (complete_ || burst_.empty()) return false;
+	++abandoned_;
+	discardBurst_();
+	return true;
+}
+
+void demo::ReorderWindow::skipGap()
+{
+	if (complete_) return;
+	discardBurst_();
+	if (occupied_ == 0) return;
+
+	// Rotate the occupancy bits so that the head is bit 0; the distance to the
+	// next waiting packet is then the number of trailing zeros.
+	size_t shift = index_(head_);
+	uint64_t rotated = shift == 0 ? occupied_ : (occupied_ >> shift) | (occupied_ << (maxSize - shift));
+	uint32_t gap = __builtin_ctzll(rotated);
+	lost_ += gap;
+	head_ = (head_ + gap) & mask_;
+}
+
+void demo::ReorderWindow::clear()
+{
+	restart_(0);
+	released_.insert(released_.end(), burst_.begin(), burst_.end());
+	burst_.clear();
+	complete_ = false;
+	started_ = false;
+	lateRun_ = 0;
+}
+
+void demo::ReorderWindow::releaseBurst()
+{
+	released_.insert(released_.end(), burst_.begin(), burst_.end());
+	burst_.clear();
+	complete_ = false;
+}
+
+void demo::ReorderWindow::discardBurst_()
+{
+	discarded_ += burst_.size();
+	released_.insert(released_.end(), burst_.begin(), burst_.end());
+	burst_.clear();
+}
+
+void demo::ReorderWindow::restart_(uint32_t sequence)
+{
+	for (size_t ii = 0; ii < maxSize; ++ii)
+	{
+		if (occupied_ & (uint64_t(1) << ii)) released_.push_back(entries_[ii].handle);
+	}
+	occupied_ = 0;
+	if (!complete_) discardBurst_();
+	head_ = sequence;
+	lateRun_ = 0;
+}
@@ -0,0 +1,170 @@
+#ifndef artdaq_demo_Generators_UDPInterface_ReorderWindow_hh
+#define artdaq_demo_Generators_UDPInterface_ReorderWindow_hh
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace demo
+{
+	/**
+	 * \brief Puts sequence-numbered packets back in order and groups them into bursts
+	 *
+	 * Each packet is identified by an opaque handle (a PacketPool packet index, in
+	 * UDPReceiver), and flagged as the start and/or the end of a burst. Packets
+	 * that arrive ahead of the next expected sequence number wait in a window,
+	 * in a slot chosen by their sequence number, with one bit per slot marking
+	 * it occupied. Inserting a packet, and moving the window on by one, are
+	 * therefore constant time however the packets are shuffled.
+	 *
+	 * Packets that are in sequence are taken out of the window straight away
+	 * and added to the current burst, so a burst may be longer than the window.
+	 * A missing packet (a gap) holds up everything behind it until it arrives or
+	 * skipGap() is called; the burst it belongs to is then discarded.
+	 *
+	 * Every packet of the current burst stays held until the burst ends, so a
+	 * burst whose end never comes could hold on to them for good. A burst that
+	 * grows longer than maxBurst packets is therefore given up on, as is one
+	 * that abandonBurst() is called for, and the rest of it is discarded as it
+	 * arrives.
+	 *
+	 * Handles of packets that are thrown away are collected in released(), for
+	 * the user to recycle.
+	 */
+	class ReorderWindow
+	{
+	public:
+		static const size_t maxSize = 64; ///< Largest supported window, in packets
+		static const uint8_t BurstStart = 0x1; ///< Flag: packet is the first of a burst
+		static const uint8_t BurstEnd = 0x2; ///< Flag: packet is the last of a burst
+
+		/**
+		 * \brief Outcome of insert()
+		 */
+		enum class Result
+		{
+			Inserted, ///< Packet is now held by the window
+			Duplicate, ///< A packet with this sequence number is already waiting
+			Late, ///< Packet is behind the window (a duplicate, or too late to use)
+			Overflow, ///< Packet is too far ahead. Call skipGap() and try again
+		};
+
+		/**
+		 * \brief ReorderWindow Constructor
+		 * \param size Number of packets that may wait for a gap to be filled. At most maxSize, and at most half the sequence number space
+		 * \param sequenceMask Mask of the valid sequence number bits, e.g. 0xFF for 8-bit sequence numbers
+		 * \param maxBurst Most packets a burst may have, or 0 for no limit
+		 */
+		ReorderWindow(size_t size, uint32_t sequenceMask, size_t maxBurst = 0);
+
+		/**
+		 * \brief Offer a packet to the window
+		 * \param sequence Sequence number of the packet
+		 * \param handle Handle of the packet
+		 * \param flags BurstStart and/or BurstEnd, or 0 for a packet in the middle of a burst
+		 * \return What was done with the packet. If not Inserted, the handle still belongs to the caller
+		 */
+		Result insert(uint32_t sequence, uint32_t handle, uint8_t flags);
+
+		/**
+		 * \brief Move every packet that is now in sequence into the current burst
+		 * \return Whether the current burst is complete. If so, burst() may be read, and releaseBurst() must be called before more packets can be added to a burst
+		 */
+		bool nextBurst();
+
+		/**
+		 * \brief Give up on the first gap: discard the current burst, and skip to the next packet that is waiting
+		 */
+		void skipGap();
+
+		/**
+		 * \brief Give up on the current burst, if it is not complete, so that its packets are released
+		 * \return Whether there was an incomplete burst to give up on
+		 */
+		bool abandonBurst();
+
+		/**
+		 * \brief Discard everything and forget the expected sequence number
+		 */
+		void clear();
+
+		/**
+		 * \brief Get the handles of the current burst, in order
+		 * \return The handles of the current burst
+		 */
+		std::vector<uint32_t> const& burst() const { return burst_; }
+
+		/**
+		 * \brief Add the handles of the (complete) current burst to released(), and start a new burst
+		 */
+		void releaseBurst();
+
+		/**
+		 * \brief Get the handles of packets the window no longer needs
+		 * \return Handles to be recycled
+		 */
+		std::vector<uint32_t> const& released() const { return released_; }
+
+		/**
+		 * \brief Forget released(), once the handles have been recycled
+		 */
+		void clearReleased() { released_.clear(); }
+
+		/**
+		 * \brief Whether any packet is waiting behind a gap
+		 * \return True if no packet is waiting
+		 */
+		bool empty() const { return occupied_ == 0; }
+
+		/**
+		 * \brief Whether any packet is held, waiting behind a gap or in a burst that has not ended
+		 * \return True if the window would give up something to skipGap() or abandonBurst()
+		 */
+		bool holding() const { return occupied_ != 0 || (!complete_ && !burst_.empty()); }
+
+		/**
+		 * \brief Get the sequence number expected next
+		 * \return The sequence number at the start of the window
+		 */
+		uint32_t head() const { return head_; }
+
+		uint64_t lost() const { return lost_; } ///< Sequence numbers skipped without the packet having been seen
+		uint64_t late() const { return late_; } ///< Packets that arrived behind the window
+		uint64_t duplicates() const { return duplicates_; } ///< Packets that arrived while one with the same sequence number was waiting
+		uint64_t discarded() const { return discarded_; } ///< Packets received but thrown away because their burst was incomplete
+		uint64_t abandoned() const { return abandoned_; } ///< Incomplete bursts given up on to release their packets: too long, or abandonBurst()
+
+	private:
+		size_t index_(uint32_t sequence) const { return sequence & (maxSize - 1); }
+		void discardBurst_();
+		void restart_(uint32_t sequence);
+
+		struct Entry
+		{
+			uint32_t handle;
+			uint8_t flags;
+		};
+
+		size_t size_;
+		uint32_t mask_;
+		size_t maxBurst_;
+		bool started_; ///< Whether head_ has been set from a packet
+		uint32_t head_;
+		uint64_t occupied_; ///< Bit i set if entries_[i] holds a packet
+		std::array<Entry, maxSize> entries_;
+		size_t lateRun_; ///< Consecutive Late packets, to detect a sender restart
+
+		std::vector<uint32_t> burst_;
+		bool complete_;
+		std::vector<uint32_t> released_;
+
+		uint64_t lost_;
+		uint64_t late_;
+		uint64_t duplicates_;
+		uint64_t discarded_;
+		uint64_t abandoned_;
+	};
+}
+
+#endif /* artdaq_demo_Generators_UDPInterface_ReorderWindow_hh */
@@ -0,0 +1,104 @@
+#ifndef artdaq_demo_Generators_UDPInterface_SPSCRing_hh
+#define artdaq_demo_Generators_UDPInterface_SPSCRing_hh
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace demo
+{
+	/**
+	 * \brief A fixed-capacity, lock-free ring buffer for exactly one producer thread and one consumer thread
+	 * \tparam T Element type. Elements are constructed once, up front, and then reused in place.
+	 *
+	 * The producer fills the slots returned by producerSlot() and then makes them
+	 * visible to the consumer with publish(). The consumer reads the slots returned
+	 * by consumerSlot() and hands them back with consume(). Neither side ever blocks.
+	 */
+	template <typename T>
+	class SPSCRing
+	{
+	public:
+		/**
+		 * \brief SPSCRing Constructor
+		 * \param capacity Minimum number of elements the ring can hold. Rounded up to a power of two.
+		 */
+		explicit SPSCRing(size_t capacity)
+			: slots_(roundUp_(capacity))
+			, mask_(slots_.size() - 1)
+			, head_(0)
+			, tail_(0)
+		{}
+
+		/**
+		 * \brief Get the number of elements the ring can hold
+		 * \return The capacity of the ring
+		 */
+		size_t capacity() const { return slots_.size(); }
+
+		/**
+		 * \brief Get the number of elements currently in the ring. Exact only when called by the producer or consumer while the other is idle.
+		 * \return The number of published, unconsumed elements
+		 */
+		size_t size() const { return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire); }
+
+		/**
+		 * \brief Producer: get the number of slots that may be filled before the next publish()
+		 * \return The number of free slots
+		 */
+		size_t writable() const { return capacity() - (head_.load(std::memory_order_relaxed) - tail_.load(std::memory_order_acquire)); }
+
+		/**
+		 * \brief Producer: access a free slot
+		 * \param ii Index of the slot, counting from the next one to be published. Must be less than writable().
+		 * \return Reference to the slot
+		 */
+		T& producerSlot(size_t ii) { return slots_[(head_.load(std::memory_order_relaxed) + ii) & mask_]; }
+
+		/**
+		 * \brief Producer: make the next count slots visible to the consumer
+		 * \param count Number of slots filled
+		 */
+		void publish(size_t count) { head_.store(head_.load(std::memory_order_relaxed) + count, std::memory_order_release); }
+
+		/**
+		 * \brief Consumer: get the number of published slots waiting to be read
+		 * \return The number of readable slots
+		 */
+		size_t readable() const { return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_relaxed); }
+
+		/**
+		 * \brief Consumer: access a published slot
+		 * \param ii Index of the slot, counting from the oldest. Must be less than readable().
+		 * \return Reference to the slot
+		 */
+		T& consumerSlot(size_t ii) { return slots_[(tail_.load(std::memory_order_relaxed) + ii) & mask_]; }
+
+		/**
+		 * \brief Consumer: return the oldest count slots to the producer
+		 * \param count Number of slots read
+		 */
+		void consume(size_t count) { tail_.store(tail_.load(std::memory_order_relaxed) + count, std::memory_order_release); }
+
+	private:
+		static size_t roundUp_(size_t capacity)
+		{
+			size_t size = 1;
+			while (size < capacity) size <<= 1;
+			return size;
+		}
+
+		std::vector<T> slots_;
+		size_t mask_;
+
+		// Keep the two indices on separate cache lines so that the producer and
+		// consumer don't fight over one
+		char pad0_[64];
+		std::atomic<size_t> head_; ///< Next slot the producer will fill
+		char pad1_[64];
+		std::atomic<size_t> tail_; ///< Next slot the consumer will read
+		char pad2_[64];
+	};
+}
+
+#endif /* artdaq_demo_Generators_UDPInterface_SPSCRing_hh */
@@ -0,0 +1,82 @@
+#ifndef artdaq_demo_Generators_UDPInterface_UDPProtocol_hh
+#define artdaq_demo_Generators_UDPInterface_UDPProtocol_hh
+
+#include <arpa/inet.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace demo
+{
+	/**
+	 * \brief The header at the start of every datagram sent to UDPReceiver
+	 *
+	 * Version 1 is two bytes: the status byte (data type in the high nibble,
+	 * ReturnCode in the low nibble), then an 8-bit sequence number.
+	 *
+	 * Version 2 is twelve bytes, with multi-byte fields in network byte order:
+	 * \verbatim
+	 * byte 0      status byte, as in version 1
+	 * byte 1      protocol version (2)
+	 * bytes 2-3   payload length, not counting the header
+	 * bytes 4-7   32-bit sequence number
+	 * bytes 8-11  burst ID; the same for every datagram of a burst, and one more for each burst
+	 * \endverbatim
+	 * An 8-bit sequence number wraps within microseconds at 10 Gbit/s, after
+	 * which loss can no longer be told from reordering; a 32-bit one does not.
+	 */
+	struct UDPHeader
+	{
+		enum : size_t
+		{
+			v1Size = 2, ///< Size of a version 1 header, in bytes
+			v2Size = 12, ///< Size of a version 2 header, in bytes
+		};
+
+		uint8_t status; ///< Data type and ReturnCode
+		uint8_t version; ///< Protocol version
+		uint16_t payloadLength; ///< Bytes of payload following the header
+		uint32_t sequence; ///< Sequence number of the datagram
+		uint32_t burstID; ///< Which burst the datagram belongs to
+
+		/**
+		 * \brief Decode a version 2 header. The caller checks that there are v2Size bytes
+		 * \param buffer The start of the datagram
+		 * \return The header
+		 */
+		static UDPHeader readV2(const uint8_t* buffer)
+		{
+			UDPHeader header;
+			uint16_t length;
+			uint32_t sequence, burstID;
+			memcpy(&length, buffer + 2, sizeof(length));
+			memcpy(&sequence, buffer + 4, sizeof(sequence));
+			memcpy(&burstID, buffer + 8, sizeof(burstID));
+			header.status = buffer[0];
+			header.version = buffer[1];
+			header.payloadLength = ntohs(length);
+			header.sequence = ntohl(sequence);
+			header.burstID = ntohl(burstID);
+			return header;
+		}
+
+		/**
+		 * \brief Encode this header in version 2 format
+		 * \param buffer Where to write it. Must have room for v2Size bytes
+		 */
+		void writeV2(uint8_t* buffer) const
+		{
+			uint16_t length = htons(payloadLength);
+			uint32_t sequenceOut = htonl(sequence);
+			uint32_t burstIDOut = htonl(burstID);
+			buffer[0] = status;
+			buffer[1] = 2;
+			memcpy(buffer + 2, &length, sizeof(length));
+			memcpy(buffer + 4, &sequenceOut, sizeof(sequenceOut));
+			memcpy(buffer + 8, &burstIDOut, sizeof(burstIDOut));
+		}
+	};
+}
+
+#endif /* artdaq_demo_Generators_UDPInterface_UDPProtocol_hh */
@@ -9,6 +9,10 @@
 // about the status of the sender
 // 2. The second word is an 8-bit sequence ID, used for detecting
 // dropped UDP datagrams
+//
+// With protocol_version 2, the header is instead the 12-byte one described
+// in UDPInterface/UDPProtocol.hh, with a 32-bit sequence number, a burst ID
+// and the payload length.
 
 // Some C++ conventions used:
 
@@ -16,6 +20,16 @@
 #include "fhiclcpp/fwd.h"
 #include "artdaq-core/Data/Fragment.hh"
 #include "artdaq/Application/CommandableFragmentGenerator.hh"
+#include "artdaq-demo/Generators/UDPInterface/SPSCRing.hh"
+#include "artdaq-demo/Generators/UDPInterface/PacketPool.hh"
+#include "artdaq-demo/Generators/UDPInterface/ReorderWindow.hh"
+#include "artdaq-demo/Generators/UDPInterface/RawOutputWriter.hh"
+#include "artdaq-demo/Generators/UDPInterface/LatencyHistogram.hh"
+#include "artdaq-demo/Generators/UDPInterface/FlatIndex.hh"
+#include "artdaq-demo/Generators/UDPInterface/UDPProtocol.hh"
+#include "artdaq-demo/Generators/UDPInterface/PcapReader.hh"
+#include "artdaq-demo/Generators/UDPInterface/JsonIndex.hh"
+#include "artdaq-demo/Generators/WakeupEvent.hh"
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
@@ -26,7 +40,11 @@
 #include <array>
 #include <list>
 #include <queue>
+#include <vector>
 #include <atomic>
+#include <thread>
+#include <chrono>
+#include <memory>
 
 namespace demo
 {
@@ -62,6 +80,17 @@ namespace demo
 		String = 2,
 	};
 
+	/**
+	 * \brief Enumeration describing where Fragment timestamps come from
+	 */
+	enum class TimestampSource : uint8_t
+	{
+		None = 0, ///< Fragments are not timestamped
+		Kernel = 1, ///< When the kernel received the first datagram of the burst
+		Receive = 2, ///< When the receive thread took the first datagram of the burst from the socket
+		Payload = 3, ///< A 64-bit big-endian timestamp in the payload of the first datagram of the burst
+	};
+
 	/**
 	 * \brief Struct defining UDP packet used for communicating with data receiver
 	 */
@@ -73,8 +102,8 @@ namespace demo
 		uint64_t data[182]; ///< The data for the CommandPacket
 	};
 
-	typedef std::array<uint8_t, 1500> packetBuffer_t; ///< An array of 1500 bytes (MTU length)
-	typedef std::list<packetBuffer_t> packetBuffer_list_t; ///< A std::list of packetbuffer_t objects
+	const size_t defaultMaxDatagramSize = 1500; ///< Largest datagram UDPReceiver accepts by default (Ethernet MTU length)
+	const size_t largestDatagramSize = 65507; ///< Largest payload a UDP/IPv4 datagram can have
 
 	/**
 	 * \brief An artdaq::CommandableFragmentGenerator which receives data in the form of UDP datagrams
@@ -93,10 +122,46 @@ namespace demo
 		 * "send_CAPTAN_commands" (Default: false): Whether to send CommandPackets to start and stop the data flow
 		 * "raw_output_enabled" (Default: false): Whether to write UDP data to disk as well as to EventBuilders
 		 * "raw_output_path" (Default: "/tmp"): Directory to save raw output file (UDPReceiver-[ip]:[port].bin)
+		 * "raw_output_buffer_size" (Default: 4194304): Size of each raw output buffer, in bytes
+		 * "raw_output_buffers" (Default: 8): Number of raw output buffers. If all are waiting for the disk, raw output is dropped
+		 * "raw_output_direct" (Default: false): Whether to write raw output with O_DIRECT, bypassing the page cache
+		 * "raw_output_max_file_size_mb" (Default: 0): Start a new raw output file (UDPReceiver-[ip]:[port]-[n].bin) at this size. 0 means one file
+		 * "protocol_version" (Default: 1): Datagram header format. 1 is a status byte and an 8-bit sequence number; 2 adds a 32-bit sequence number, a burst ID and the payload length (see UDPProtocol.hh)
+		 * "max_datagram_size" (Default: 1500): Largest datagram expected, in bytes (up to 65507; e.g. 9000 for jumbo frames). Longer datagrams are counted and dropped
+		 * "receive_batch_size" (Default: 64): Maximum number of datagrams to take from the socket per system call
+		 * "receive_ring_size" (Default: 1024): Number of datagrams that can be held between each receive thread and getNext_, including those in partly assembled bursts
+		 * "receive_gro" (Default: false): Whether to have the kernel coalesce datagrams of one sender into a single receive (UDP_GRO), where the kernel supports it
+		 * "receive_gro_buffers" (Default: 256): With receive_gro, the number of 64 KiB receive buffers per receive thread, each holding up to 64 datagrams. Replaces receive_ring_size
+		 * "receive_threads" (Default: 1): Number of sockets, each with its own receive thread, to bind to the port with SO_REUSEPORT
+		 * "receive_cpus" (Default: []): CPUs to pin the receive threads to, one per thread, reused in turn if there are fewer CPUs than threads
+		 * "busy_poll_us" (Default: 0): Have the kernel busy-poll the network device for this long when a socket is polled (SO_BUSY_POLL). 0 leaves it off. Values above net.core.busy_read need CAP_NET_ADMIN
+		 * "spin_us" (Default: 0): How long the receive threads and getNext_ keep checking for new data before going to sleep. Cuts wakeup latency at the cost of a busy CPU per thread. 0 sleeps at once
+		 * "reorder_window_size" (Default: 32): Number of datagrams that may arrive ahead of a missing one before it is given up on (at most 64)
+		 * "reorder_timeout_ms" (Default: 10): How long to wait for a missing datagram, or for the rest of a burst, before giving up on the burst
+		 * "max_burst_datagrams" (Default: half of receive_ring_size, or of receive_gro_buffers with receive_gro): Longest burst to assemble. Longer ones, and any burst still incomplete when the receive ring is nearly full, are dropped so that their slots can be reused. At most receive_ring_size (receive_gro_buffers)
+		 * "fragments_per_call" (Default: 64): Most fragments (bursts) getNext_ returns at once. It returns as soon as there is one, but takes any others already complete, up to this many
+		 * "call_time_budget_us" (Default: 1000): Once this long has been spent in getNext_ after the first burst was complete, return what there is
+		 * "max_sources" (Default: 256): Number of senders (address and port) to assemble bursts for, per receive thread. Datagrams from any more are counted and dropped
+		 * "receive_buffer_size" (Default: 0): Socket receive buffer size to ask for (SO_RCVBUF), in bytes. 0 leaves the system default
+		 * "receive_buffer_force" (Default: true): Whether to try SO_RCVBUFFORCE first, which may exceed net.core.rmem_max but needs CAP_NET_ADMIN
+		 * "kernel_timestamps" (Default: true): Whether to have the kernel timestamp each datagram (SO_TIMESTAMPNS), for the time in queue and burst assembly time metrics
+		 * "timestamp_source" (Default: "none"): What to set Fragment timestamps to. "none" leaves them unset; "kernel" uses the kernel timestamp of the first datagram of the burst, in ns since the epoch; "receive" uses the time the receive thread took it, in ns since the epoch; "payload" uses a timestamp the sender put in it. Needed for the Window and Buffer request modes
+		 * "payload_timestamp_offset" (Default: 0): With timestamp_source "payload", where the 64-bit big-endian timestamp is in the payload of the first datagram of a burst, in bytes after the header
+		 * "json_index" (Default: false): Whether to index the members of JSON (and JSON-formatted String) bursts as they are made into fragments, so that readers can find values without parsing the text. The index follows the text's NUL in the payload; see JsonIndex
+		 * "json_index_max_entries" (Default: 256): Most members to index per fragment (at most 65535). Fragments with more are indexed up to here and flagged as truncated
+		 * "metric_interval_s" (Default: 1.0): How often to send receive metrics, in seconds
+		 * "pcap_file" (Default: ""): Instead of opening a socket, replay the UDP datagrams in this pcap or pcapng capture, from the beginning at each start. Receive options other than receive_ring_size and receive_batch_size do not apply
+		 * "pcap_port" (Default: port): Replay only datagrams sent to this port. 0 replays every UDP datagram in the capture
+		 * "pcap_speed" (Default: 0): Replay at the captured pace times this factor (1 is real time, 20 twenty times faster). 0 replays as fast as getNext_ takes the data
 		 * \endverbatim
 		 */
 		explicit UDPReceiver(fhicl::ParameterSet const& ps);
 
+		/**
+		 * \brief UDPReceiver Destructor. Stops the receive threads and closes the sockets
+		 */
+		virtual ~UDPReceiver();
+
 	private:
 
 		// The "getNext_" function is used to implement user-specific
@@ -109,9 +174,12 @@ namespace demo
 
 		void stop() override;
 
-		void stopNoMutex() override {} // nothing special needs to be done in this method
+		void stopNoMutex() override;
+
 		void pause() override;
 
+		void pauseNoMutex() override;
+
 		void resume() override;
 
 		DataType getDataType(uint8_t byte) { return static_cast<DataType>((byte & 0xF0) >> 4); }
@@ -119,24 +187,323 @@ namespace demo
 
 		void send(CommandType flag);
 
+		/**
+		 * \brief Burst assembly state for one sender
+		 *
+		 * Each sender numbers its datagrams independently, so each has a window
+		 * of its own. The sender is identified by its address and port.
+		 */
+		struct Source
+		{
+			/**
+			 * \brief Source Constructor
+			 * \param address IPv4 address of the sender, in network byte order
+			 * \param port UDP port of the sender, in host byte order
+			 * \param windowSize Size of the reorder window
+			 * \param sequenceMask Mask of the valid sequence number bits
+			 * \param maxBurst Longest burst to assemble
+			 */
+			Source(uint32_t address, uint16_t port, size_t windowSize, uint32_t sequenceMask, size_t maxBurst);
+
+			uint32_t address; ///< IPv4 address of the sender, in network byte order
+			uint16_t port; ///< UDP port of the sender, in host byte order
+			ReorderWindow window; ///< Puts the datagrams in order and groups them into bursts
+			uint32_t lastWindowHead; ///< window.head() when last looked at
+			std::chrono::steady_clock::time_point lastWindowProgress; ///< When window last moved on
+			bool burstIDKnown; ///< Whether nextBurstID has been seen yet (protocol version 2)
+			uint32_t nextBurstID; ///< Burst ID expected next (protocol version 2)
+			uint64_t lostBursts; ///< Bursts never completed, from gaps in the burst IDs (protocol version 2)
+			uint64_t mixedBursts; ///< Bursts discarded because their datagrams had different burst IDs (protocol version 2)
+		};
+
+		/**
+		 * \brief Everything belonging to one receive socket and the thread that drains it
+		 *
+		 * Datagrams are received by a dedicated thread, which keeps the socket
+		 * drained while getNext_ is busy elsewhere. They land in pool slots taken
+		 * from freeSlots, and their packet indices are handed to getNext_ through
+		 * ring. getNext_ orders them by sequence number in the window of the
+		 * Source that sent them, and releases them once their burst has been
+		 * copied into the fragment. A slot goes back to freeSlots when every
+		 * datagram in it has been released; with UDP_GRO, one slot can hold
+		 * many. If no slot is free, the thread discards datagrams and counts
+		 * them in ringOverflows.
+		 */
+		struct ReceiveChannel
+		{
+			/**
+			 * \brief ReceiveChannel Constructor
+			 * \param slots Number of receive buffers the pool holds
+			 * \param slotBytes Size of each receive buffer
+			 * \param segments Most datagrams one receive buffer can hold (more than 1 with UDP_GRO)
+			 * \param batchSize Maximum number of receive buffers per recvmmsg call
+			 * \param windowSize Size of the reorder window of each Source
+			 * \param sequenceMask Mask of the valid sequence number bits
+			 * \param maxBurst Longest burst each Source assembles
+			 */
+			ReceiveChannel(size_t slots, size_t slotBytes, size_t segments, size_t batchSize, size_t windowSize, uint32_t sequenceMask, size_t maxBurst);
+
+			int socket; ///< The socket this channel drains
+			PacketPool pool; ///< Datagram storage
+			SPSCRing<uint32_t> ring; ///< Packet indices of received datagrams, from the receive thread to getNext_
+			SPSCRing<uint32_t> freeSlots; ///< Empty slots, from getNext_ to the receive thread
+			size_t windowSize; ///< Size of the reorder window of each Source
+			uint32_t sequenceMask; ///< Mask of the valid sequence number bits
+			size_t maxBurst; ///< Longest burst each Source assembles
+			std::vector<std::unique_ptr<Source>> sources; ///< Every sender heard from, in order of first appearance
+			FlatIndex sourceIndex; ///< Index into sources, by (address << 16 | port)
+			Source* current; ///< Source whose burst was returned last; it may have another one ready
+			uint32_t pendingPacket; ///< Packet taken from ring but not yet accepted by a window
+			std::chrono::steady_clock::time_point lastSweep; ///< When the windows were last checked for timed-out gaps
+			uint64_t unknownSources; ///< Datagrams dropped because max_sources senders were already known
+			uint64_t malformed; ///< Datagrams dropped because their header was short or inconsistent
+			std::thread thread; ///< The receive thread
+
+			// recvmmsg arguments, used only by the receive thread
+			std::vector<struct mmsghdr> batchMsgs; ///< One message header per datagram
+			std::vector<struct iovec> batchIovecs; ///< One buffer per datagram
+			std::vector<struct sockaddr_in> batchAddrs; ///< Sender address of each datagram
+			std::vector<char> batchControl; ///< Room for the control messages (timestamps) of each datagram
+			std::array<uint8_t, 65536> discardBuffer; ///< Where datagrams go when no slot is free
+
+			std::atomic<size_t> ringHighWater; ///< Most pool slots in use since the last metric report
+			std::atomic<uint64_t> ringOverflows; ///< Datagrams discarded because no pool slot was free
+			std::atomic<uint64_t> truncated; ///< Datagrams discarded because they were longer than max_datagram_size
+			std::atomic<uint64_t> kernelDrops; ///< Datagrams the kernel dropped because the socket buffer was full (SO_RXQ_OVFL)
+			std::atomic<uint64_t> lastPublish; ///< When the receive thread last published to ring, in steady_clock ns
+			std::atomic<uint64_t> spinTime; ///< Time the receive thread has spent spinning without finding data, in ns
+			uint32_t lastDropCounter; ///< Last SO_RXQ_OVFL value seen, used only by the receive thread, and by start() before it runs
+		};
+
+		/**
+		 * \brief Release a datagram, returning its pool slot to the channel's receive thread if nothing else in it is in use
+		 * \param channel The channel the datagram belongs to
+		 * \param packet Packet index of the datagram
+		 */
+		void releasePacket_(ReceiveChannel& channel, uint32_t packet);
+
+		/**
+		 * \brief Return the slots a window has finished with to its channel's receive thread
+		 * \param channel The channel
+		 * \param window The window, which belongs to one of the channel's sources
+		 */
+		void releaseWindowSlots_(ReceiveChannel& channel, ReorderWindow& window);
+
+		/**
+		 * \brief Find the Source a datagram came from, adding it if it is new
+		 * \param channel The channel the datagram was received on
+		 * \param header The header of the datagram's slot
+		 * \return The Source, or nullptr if it is new and max_sources are already known
+		 */
+		Source* findSource_(ReceiveChannel& channel, PacketPool::SlotHeader const& header);
+
+		/**
+		 * \brief Check whether a source's window holds a complete burst, and note whether it has moved on
+		 * \param channel The channel the source belongs to. Slots the window has finished with are returned to it
+		 * \param source The source
+		 * \param now The current time
+		 * \return Whether source.window holds a complete burst
+		 */
+		bool burstReady_(ReceiveChannel& channel, Source& source, std::chrono::steady_clock::time_point now);
+
+		/**
+		 * \brief Check the burst IDs of a complete burst (protocol version 2), and count the bursts missing before it
+		 * \param channel The channel the source belongs to
+		 * \param source The source, whose window holds a complete burst
+		 * \return Whether every datagram of the burst has the same burst ID
+		 */
+		bool checkBurstID_(ReceiveChannel& channel, Source& source);
+
+		/**
+		 * \brief Give up on the gaps that have not been filled, and the bursts that have not ended, for reorder_timeout_ms
+		 * \param channel The channel whose sources to check
+		 * \param now The time to measure from: now, or when the oldest datagram still in the ring arrived
+		 * \return A source that has a complete burst as a result, or nullptr
+		 */
+		Source* sweepGaps_(ReceiveChannel& channel, std::chrono::steady_clock::time_point now);
+
+		/**
+		 * \brief If the receive thread is nearly out of free slots, drop the longest incomplete burst to return its slots
+		 * \param channel The channel to check, whose ring is empty
+		 */
+		void reclaimSlots_(ReceiveChannel& channel);
+
+		/**
+		 * \brief Look for a complete burst on each channel in turn, starting after the one that gave the last
+		 * \param[out] channel Set to the channel the burst is on
+		 * \param[out] waiting Set to true if no burst is complete but some window is waiting for a gap to be filled
+		 * \return The Source whose window holds a complete burst, or nullptr
+		 */
+		Source* takeBurst_(ReceiveChannel*& channel, bool& waiting);
+
+		/**
+		 * \brief Copy a complete burst into a new UDPFragment, and release its datagrams
+		 * \param channel The channel the burst is on
+		 * \param source The Source whose window holds the burst
+		 * \param frags The fragment is appended here
+		 */
+		void makeFragment_(ReceiveChannel& channel, Source& source, artdaq::FragmentPtrs& frags);
+
+		/**
+		 * \brief Feed the datagrams a channel has received to their sources' windows until a burst is complete
+		 * \param channel The channel
+		 * \return The Source whose window holds a complete burst, or nullptr, in which case channel.ring is empty
+		 */
+		Source* nextBurst_(ReceiveChannel& channel);
+
+		/**
+		 * \brief Apply receive_buffer_size to a socket
+		 * \param socket The socket
+		 */
+		void setReceiveBuffer_(int socket);
+
+		/**
+		 * \brief Set up the control message and sender address buffers of a channel for the next recvmmsg
+		 * \param channel The channel
+		 * \param count Number of messages
+		 */
+		void prepareControl_(ReceiveChannel& channel, size_t count);
+
+		/**
+		 * \brief Body of a receive thread. Drains the channel's socket into its ring until receiving_ is cleared
+		 * \param channel The channel to receive on
+		 */
+		void receiveLoop_(ReceiveChannel& channel);
+
+		/**
+		 * \brief Body of the receive thread when replaying pcap_file. Feeds the datagrams in it into the channel's ring
+		 * \param channel The channel to replay into
+		 *
+		 * Rather than dropping datagrams when the ring is full, as a socket would,
+		 * this waits for getNext_ to catch up, so that a replay gives the same
+		 * result every time.
+		 */
+		void replayLoop_(ReceiveChannel& channel);
+
+		/**
+		 * \brief Hand datagrams in a channel's ring to getNext_, and wake it if it is asleep
+		 * \param channel The channel
+		 * \param count Number of datagrams written to the ring since the last publish
+		 */
+		void publish_(ReceiveChannel& channel, size_t count);
+
+		/**
+		 * \brief Read the control messages of a received datagram
+		 * \param channel The channel it was received on. Its kernel drop count is updated
+		 * \param msg The message header of the datagram
+		 * \param segmentSize Set to the size of each coalesced datagram if the kernel coalesced several (UDP_GRO), or to 0
+		 * \return The kernel timestamp of the datagram, in ns since the epoch, or 0 if there was none
+		 */
+		uint64_t readControl_(ReceiveChannel& channel, struct msghdr& msg, size_t& segmentSize);
+
+		/**
+		 * \brief Throw away the datagrams that queued up on a socket while no run was going, and the drops they caused
+		 * \param channel The channel, whose receive thread is not running
+		 */
+		void drainSocket_(ReceiveChannel& channel);
+
+		/**
+		 * \brief Start the receive threads, if they are not running
+		 */
+		void startReceiving_();
+
+		/**
+		 * \brief Stop the receive threads and wait for them to exit
+		 */
+		void stopReceiving_();
+
+		/**
+		 * \brief Wait for a receive thread to publish data, spinning for up to spin_us first
+		 * \param timeout_ms Longest time to wait, in milliseconds
+		 */
+		void waitForData_(int timeout_ms);
+
+		/**
+		 * \brief Check whether getNext_ should return false, and if so, report how long it took to notice
+		 * \return True if the run is being stopped or paused
+		 */
+		bool stopping_();
+
+		/**
+		 * \brief Check whether a receive thread has published data getNext_ has not taken yet
+		 * \return The channel with data, or nullptr
+		 */
+		ReceiveChannel* dataReady_();
+
+		/**
+		 * \brief Send ring statistics to the metric manager, if metric_interval_s has passed since last time
+		 */
+		void reportMetrics_();
+
 		// FHiCL-configurable variables. Note that the C++ variable names
 		// are the FHiCL variable names with a "_" appended
 
 		int dataport_;
 		std::string ip_;
-
-		//The packet number of the next packet. Used to discover dropped packets
-		uint8_t expectedPacketNumber_;
+		int protocolVersion_;
+		size_t headerBytes_; ///< Size of the datagram header for protocolVersion_
+		size_t maxDatagramSize_;
 
 		//Socket parameters
 		struct sockaddr_in si_data_;
-		int datasocket_;
 		bool sendCommands_;
 
-		packetBuffer_list_t packetBuffers_;
-
 		bool rawOutput_;
 		std::string rawPath_;
+		RawOutputWriter rawWriter_; ///< Writes raw output from a thread of its own, open from start() to stop()
+
+		// One channel per receive socket. With more than one, the sockets share
+		// the port through SO_REUSEPORT, and the kernel spreads the senders
+		// across them, each sender always to the same one.
+		std::vector<std::unique_ptr<ReceiveChannel>> channels_;
+		size_t nextChannel_; ///< Channel getNext_ looks at first, for fairness
+		std::chrono::milliseconds reorderTimeout_;
+		size_t maxSources_;
+		size_t fragmentsPerCall_;
+		std::chrono::microseconds callTimeBudget_;
+		size_t receiveBufferSize_;
+		bool receiveBufferForce_;
+		bool kernelTimestamps_;
+		TimestampSource timestampSource_;
+		size_t payloadTimestampOffset_;
+		std::atomic<bool> receiving_;
+		int dataReadyFd_; ///< eventfd the receive threads write after publishing to their rings, if getNext_ is asleep
+		std::atomic<bool> consumerWaiting_; ///< Whether getNext_ is asleep, or about to be, waiting for dataReadyFd_
+		WakeupEvent stopEvent_; ///< Signalled by stopNoMutex and pauseNoMutex, to wake getNext_
+		WakeupEvent receiveStop_; ///< Signalled by stopReceiving_, to wake the receive threads
+		std::vector<int> receiveCpus_;
+		int busyPoll_;
+		std::chrono::nanoseconds spinTime_;
+		std::string pcapFile_;
+		int pcapPort_;
+		double pcapSpeed_;
+		bool jsonIndex_;
+		size_t jsonIndexMaxEntries_;
+		uint64_t unindexedJson_; ///< JSON fragments whose text would not index, counted by getNext_
+		uint64_t consumerSpinTime_; ///< Time getNext_ has spent spinning without finding data, in ns
+		uint64_t lastSpinTime_;
+
+		double metricInterval_;
+		std::chrono::steady_clock::time_point lastMetricTime_;
+		uint64_t lastRingOverflows_;
+		uint64_t lastTruncated_;
+		uint64_t lastKernelDrops_;
+		uint64_t lastRawDropped_;
+		uint64_t lastLost_;
+		uint64_t lastLate_;
+		uint64_t lastDuplicates_;
+		uint64_t lastDiscarded_;
+		uint64_t lastUnknownSources_;
+		uint64_t lastMalformed_;
+		uint64_t lastLostBursts_;
+		uint64_t lastMixedBursts_;
+		uint64_t lastAbandonedBursts_;
+		uint64_t lastUnindexedJson_;
+
+		// Filled by getNext_, and sent and cleared with the other metrics
+		LatencyHistogram queueTime_; ///< From the kernel receiving a datagram to the receive thread taking it
+		LatencyHistogram assemblyTime_; ///< From the kernel receiving the first datagram of a burst to the burst being complete
+		LatencyHistogram wakeupLatency_; ///< From a receive thread publishing to getNext_, when waiting, noticing
 	};
 }
 
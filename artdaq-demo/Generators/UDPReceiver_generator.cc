@@ -13,33 +13,317 @@
 #include <iomanip>
 #include <iterator>
 #include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <functional>
+#include <linux/sock_diag.h>
+#include <netinet/udp.h>
 #include <sys/poll.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#ifndef UDP_GRO
+#define UDP_GRO 104 // From linux/udp.h; older C libraries don't have it
+#endif
+
+namespace
+{
+	// Room for the control messages of one receive
+	const size_t controlBytes = CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(uint32_t)) + CMSG_SPACE(sizeof(int));
+
+	// The kernel coalesces at most 64 datagrams, and at most 64 KiB, into one
+	// UDP_GRO receive
+	const size_t groBufferBytes = 65536;
+	const size_t groSegments = 64;
+
+	uint64_t nowNs()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+	}
+
+	uint64_t steadyNs()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	std::string sourceName(uint32_t address, uint16_t port)
+	{
+		char text[INET_ADDRSTRLEN];
+		inet_ntop(AF_INET, &address, text, sizeof(text));
+		return std::string(text) + ":" + std::to_string(port);
+	}
+}
+
+demo::UDPReceiver::Source::Source(uint32_t address, uint16_t port, size_t windowSize, uint32_t sequenceMask, size_t maxBurst)
+	: address(address)
+	, port(port)
+	, window(windowSize, sequenceMask, maxBurst)
+	, lastWindowHead(0)
+	, lastWindowProgress(std::chrono::steady_clock::now())
+	, burstIDKnown(false)
+	, nextBurstID(0)
+	, lostBursts(0)
+	, mixedBursts(0)
+{}
+
+demo::UDPReceiver::ReceiveChannel::ReceiveChannel(size_t slots, size_t slotBytes, size_t segments, size_t batchSize, size_t windowSize, uint32_t sequenceMask, size_t maxBurst)
+	: socket(-1)
+	, pool(slots, slotBytes, segments)
+	, ring(pool.packets())
+	, freeSlots(slots)
+	, windowSize(windowSize)
+	, sequenceMask(sequenceMask)
+	, maxBurst(maxBurst)
+	, current(nullptr)
+	, pendingPacket(PacketPool::npos)
+	, lastSweep(std::chrono::steady_clock::now())
+	, unknownSources(0)
+	, malformed(0)
+	, batchMsgs(batchSize)
+	, batchIovecs(batchSize)
+	, batchAddrs(batchSize)
+	, batchControl(batchSize * controlBytes)
+	, ringHighWater(0)
+	, ringOverflows(0)
+	, truncated(0)
+	, kernelDrops(0)
+	, lastPublish(0)
+	, spinTime(0)
+	, lastDropCounter(0)
+{
+	for (size_t ii = 0; ii < batchMsgs.size(); ++ii)
+	{
+		memset(&batchMsgs[ii], 0, sizeof(struct mmsghdr));
+		batchMsgs[ii].msg_hdr.msg_iov = &batchIovecs[ii];
+		batchMsgs[ii].msg_hdr.msg_iovlen = 1;
+		batchMsgs[ii].msg_hdr.msg_name = &batchAddrs[ii];
+	}
+
+	// Every slot starts out free
+	for (uint32_t ii = 0; ii < pool.slots(); ++ii)
+	{
+		freeSlots.producerSlot(ii) = ii;
+	}
+	freeSlots.publish(pool.slots());
+}
 
 demo::UDPReceiver::UDPReceiver(fhicl::ParameterSet const& ps)
 	: CommandableFragmentGenerator(ps)
 	, dataport_(ps.get<int>("port", 6343))
 	, ip_(ps.get<std::string>("ip", "127.0.0.1"))
-	, expectedPacketNumber_(0)
+	, protocolVersion_(ps.get<int>("protocol_version", 1))
+	, headerBytes_(UDPHeader::v1Size)
+	, maxDatagramSize_(ps.get<size_t>("max_datagram_size", defaultMaxDatagramSize))
 	, sendCommands_(ps.get<bool>("send_CAPTAN_commands", false))
 	, rawOutput_(ps.get<bool>("raw_output_enabled", false))
 	, rawPath_(ps.get<std::string>("raw_output_path", "/tmp"))
+	, rawWriter_(ps.get<size_t>("raw_output_buffer_size", 4 << 20), ps.get<size_t>("raw_output_buffers", 8),
+	             ps.get<bool>("raw_output_direct", false), ps.get<uint64_t>("raw_output_max_file_size_mb", 0) << 20)
+	, nextChannel_(0)
+	, reorderTimeout_(ps.get<int>("reorder_timeout_ms", 10))
+	, maxSources_(ps.get<size_t>("max_sources", 256))
+	, fragmentsPerCall_(std::max(ps.get<size_t>("fragments_per_call", 64), size_t(1)))
+	, callTimeBudget_(ps.get<int>("call_time_budget_us", 1000))
+	, receiveBufferSize_(ps.get<size_t>("receive_buffer_size", 0))
+	, receiveBufferForce_(ps.get<bool>("receive_buffer_force", true))
+	, kernelTimestamps_(ps.get<bool>("kernel_timestamps", true))
+	, timestampSource_(TimestampSource::None)
+	, payloadTimestampOffset_(ps.get<size_t>("payload_timestamp_offset", 0))
+	, receiving_(false)
+	, dataReadyFd_(-1)
+	, consumerWaiting_(false)
+	, receiveCpus_(ps.get<std::vector<int>>("receive_cpus", std::vector<int>()))
+	, busyPoll_(ps.get<int>("busy_poll_us", 0))
+	, spinTime_(std::chrono::microseconds(ps.get<int>("spin_us", 0)))
+	, pcapFile_(ps.get<std::string>("pcap_file", ""))
+	, pcapPort_(ps.get<int>("pcap_port", dataport_))
+	, pcapSpeed_(ps.get<double>("pcap_speed", 0))
+	, jsonIndex_(ps.get<bool>("json_index", false))
+	, jsonIndexMaxEntries_(ps.get<size_t>("json_index_max_entries", 256))
+	, unindexedJson_(0)
+	, consumerSpinTime_(0)
+	, lastSpinTime_(0)
+	, metricInterval_(ps.get<double>("metric_interval_s", 1.0))
+	, lastMetricTime_(std::chrono::steady_clock::now())
+	, lastRingOverflows_(0)
+	, lastTruncated_(0)
+	, lastKernelDrops_(0)
+	, lastRawDropped_(0)
+	, lastLost_(0)
+	, lastLate_(0)
+	, lastDuplicates_(0)
+	, lastDiscarded_(0)
+	, lastUnknownSources_(0)
+	, lastMalformed_(0)
+	, lastLostBursts_(0)
+	, lastMixedBursts_(0)
+	, lastAbandonedBursts_(0)
+	, lastUnindexedJson_(0)
 {
-	datasocket_ = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-	if (datasocket_ < 0)
+	size_t windowSize = ps.get<size_t>("reorder_window_size", 32);
+	if (windowSize < 1 || windowSize > ReorderWindow::maxSize)
 	{
-		throw art::Exception(art::errors::Configuration) << "UDPReceiver: Error creating socket!" << std::endl;
-		exit(1);
+		throw art::Exception(art::errors::Configuration) << "UDPReceiver: reorder_window_size must be between 1 and " << ReorderWindow::maxSize << std::endl;
+	}
+	if (maxSources_ < 1)
+	{
+		throw art::Exception(art::errors::Configuration) << "UDPReceiver: max_sources must be at least 1" << std::endl;
+	}
+	if (jsonIndexMaxEntries_ > 0xFFFF)
+	{
+		throw art::Exception(art::errors::Configuration) << "UDPReceiver: json_index_max_entries must be at most 65535" << std::endl;
 	}
+	size_t threads = ps.get<size_t>("receive_threads", 1);
+	if (threads < 1)
+	{
+		throw art::Exception(art::errors::Configuration) << "UDPReceiver: receive_threads must be at least 1" << std::endl;
+	}
+	size_t slots = ps.get<size_t>("receive_ring_size", 1024);
+	bool gro = ps.get<bool>("receive_gro", false);
+	size_t groBuffers = ps.get<size_t>("receive_gro_buffers", 256);
+	size_t batchSize = std::max(ps.get<size_t>("receive_batch_size", 64), size_t(1));
 
-	struct sockaddr_in si_me_data;
-	si_me_data.sin_family = AF_INET;
-	si_me_data.sin_port = htons(dataport_);
-	si_me_data.sin_addr.s_addr = htonl(INADDR_ANY);
-	if (bind(datasocket_, (struct sockaddr *)&si_me_data, sizeof(si_me_data)) == -1)
+	// A burst holds on to its slots until it is complete, so one longer than
+	// the pool would never be
+	size_t poolSlots = gro ? std::min(slots, groBuffers) : slots;
+	size_t maxBurst = ps.get<size_t>("max_burst_datagrams", std::max(poolSlots / 2, size_t(1)));
+	if (maxBurst < 1 || maxBurst > poolSlots)
 	{
-		throw art::Exception(art::errors::Configuration) <<
-		      "UDPReceiver: Cannot bind data socket to port " << dataport_ << std::endl;
-		exit(1);
+		throw art::Exception(art::errors::Configuration) << "UDPReceiver: max_burst_datagrams must be between 1 and " << poolSlots
+		                                                 << "; increase " << (gro ? "receive_gro_buffers" : "receive_ring_size") << " for longer bursts" << std::endl;
+	}
+	std::string timestampSource = ps.get<std::string>("timestamp_source", "none");
+	if (timestampSource == "kernel") { timestampSource_ = TimestampSource::Kernel; }
+	else if (timestampSource == "receive") { timestampSource_ = TimestampSource::Receive; }
+	else if (timestampSource == "payload") { timestampSource_ = TimestampSource::Payload; }
+	else if (timestampSource != "none")
+	{
+		throw art::Exception(art::errors::Configuration) << "UDPReceiver: Unknown timestamp_source \"" << timestampSource << "\"" << std::endl;
+	}
+	std::string requestMode = ps.get<std::string>("request_mode", "ignored");
+	std::transform(requestMode.begin(), requestMode.end(), requestMode.begin(), ::tolower);
+	if (timestampSource_ == TimestampSource::None && (requestMode == "window" || requestMode == "buffer"))
+	{
+		mf::LogWarning("UDPReceiver") << "request_mode \"" << requestMode << "\" selects Fragments by timestamp, but timestamp_source is \"none\"";
+	}
+
+	if (protocolVersion_ != 1 && protocolVersion_ != 2)
+	{
+		throw art::Exception(art::errors::Configuration) << "UDPReceiver: protocol_version must be 1 or 2" << std::endl;
+	}
+	uint32_t sequenceMask = 0xFF;
+	if (protocolVersion_ == 2)
+	{
+		headerBytes_ = UDPHeader::v2Size;
+		sequenceMask = 0xFFFFFFFF;
+	}
+
+	if (maxDatagramSize_ < headerBytes_ || maxDatagramSize_ > largestDatagramSize)
+	{
+		throw art::Exception(art::errors::Configuration) << "UDPReceiver: max_datagram_size must be between " << headerBytes_ << " and " << largestDatagramSize << std::endl;
+	}
+
+	dataReadyFd_ = eventfd(0, EFD_NONBLOCK);
+	if (dataReadyFd_ < 0)
+	{
+		throw art::Exception(art::errors::Configuration) << "UDPReceiver: Error creating eventfd: " << strerror(errno) << std::endl;
+	}
+
+	// Replaying a capture needs no sockets, only somewhere to put the datagrams
+	size_t sockets = pcapFile_.empty() ? threads : 0;
+	if (!pcapFile_.empty())
+	{
+		PcapReader reader;
+		if (!reader.open(pcapFile_))
+		{
+			throw art::Exception(art::errors::Configuration) << "UDPReceiver: Cannot replay pcap_file: " << reader.error() << std::endl;
+		}
+		if (pcapSpeed_ < 0)
+		{
+			throw art::Exception(art::errors::Configuration) << "UDPReceiver: pcap_speed must not be negative" << std::endl;
+		}
+		channels_.emplace_back(new ReceiveChannel(slots, maxDatagramSize_, 1, batchSize, windowSize, sequenceMask, maxBurst));
+		mf::LogInfo("UDPReceiver") << "Replaying " << pcapFile_ << " instead of receiving on port " << dataport_;
+	}
+
+	for (size_t ii = 0; ii < sockets; ++ii)
+	{
+		int datasocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		if (datasocket < 0)
+		{
+			throw art::Exception(art::errors::Configuration) << "UDPReceiver: Error creating socket!" << std::endl;
+			exit(1);
+		}
+
+		if (threads > 1)
+		{
+			int one = 1;
+			if (setsockopt(datasocket, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0)
+			{
+				throw art::Exception(art::errors::Configuration) <<
+				      "UDPReceiver: Cannot set SO_REUSEPORT on data socket: " << strerror(errno) << std::endl;
+			}
+		}
+
+		setReceiveBuffer_(datasocket);
+
+		if (busyPoll_ > 0 && setsockopt(datasocket, SOL_SOCKET, SO_BUSY_POLL, &busyPoll_, sizeof(busyPoll_)) < 0)
+		{
+			mf::LogWarning("UDPReceiver") << "Cannot enable busy polling (SO_BUSY_POLL): " << strerror(errno)
+			                              << "; busy_poll_us above net.core.busy_read needs CAP_NET_ADMIN";
+		}
+
+		// Have the kernel tell us how many datagrams it has dropped for want of
+		// buffer space, so that they can be told apart from network loss
+		int one = 1;
+		if (setsockopt(datasocket, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one)) < 0)
+		{
+			mf::LogWarning("UDPReceiver") << "Cannot enable kernel drop counting (SO_RXQ_OVFL): " << strerror(errno);
+		}
+
+		if (kernelTimestamps_)
+		{
+			if (setsockopt(datasocket, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one)) < 0)
+			{
+				mf::LogWarning("UDPReceiver") << "Cannot enable kernel timestamps (SO_TIMESTAMPNS): " << strerror(errno);
+			}
+		}
+
+		// With UDP_GRO, each receive buffer has room for as many datagrams as
+		// the kernel will coalesce, and they are left where they land.
+		// Without it (kernels before 5.0), receive one datagram at a time.
+		bool coalesce = gro && setsockopt(datasocket, SOL_UDP, UDP_GRO, &one, sizeof(one)) == 0;
+		if (gro && !coalesce)
+		{
+			mf::LogWarning("UDPReceiver") << "UDP generic receive offload (UDP_GRO) is not available: " << strerror(errno)
+			                              << "; receiving one datagram at a time";
+		}
+		if (coalesce)
+		{
+			channels_.emplace_back(new ReceiveChannel(groBuffers, groBufferBytes, groSegments, batchSize, windowSize, sequenceMask, maxBurst));
+		}
+		else
+		{
+			channels_.emplace_back(new ReceiveChannel(slots, maxDatagramSize_, 1, batchSize, windowSize, sequenceMask, maxBurst));
+		}
+		channels_.back()->socket = datasocket;
+
+		struct sockaddr_in si_me_data;
+		si_me_data.sin_family = AF_INET;
+		si_me_data.sin_port = htons(dataport_);
+		si_me_data.sin_addr.s_addr = htonl(INADDR_ANY);
+		if (bind(datasocket, (struct sockaddr *)&si_me_data, sizeof(si_me_data)) == -1)
+		{
+			throw art::Exception(art::errors::Configuration) <<
+			      "UDPReceiver: Cannot bind data socket to port " << dataport_ << std::endl;
+			exit(1);
+		}
 	}
 
 	si_data_.sin_family = AF_INET;
@@ -52,17 +336,89 @@ demo::UDPReceiver::UDPReceiver(fhicl::ParameterSet const& ps)
 	}
 }
 
+demo::UDPReceiver::~UDPReceiver()
+{
+	stopReceiving_();
+	close(dataReadyFd_);
+	for (auto& channel : channels_)
+	{
+		if (channel->socket >= 0) close(channel->socket);
+	}
+}
 
 bool demo::UDPReceiver::getNext_(artdaq::FragmentPtrs& frags)
 {
-	if (should_stop())
+	if (stopping_())
 	{
 		return false;
 	}
 
+	ReceiveChannel* channel = nullptr;
+	Source* source = nullptr;
+	while (source == nullptr)
+	{
+		if (stopping_())
+		{
+			return false;
+		}
+		reportMetrics_();
+
+		bool waiting = false;
+		source = takeBurst_(channel, waiting);
+
+		// Every ring is empty. If a window is waiting for a gap to be filled,
+		// come back in time to give up on it.
+		if (source == nullptr)
+		{
+			waitForData_(waiting ? reorderTimeout_.count() + 1 : 1000);
+		}
+	}
+
+	// Once there is one burst, take whatever else is complete already, up to
+	// fragments_per_call fragments or call_time_budget_us, so that a flood of
+	// small bursts doesn't cost a trip through the framework each
+	auto start = std::chrono::steady_clock::now();
+	size_t made = 0;
+	while (source != nullptr)
+	{
+		makeFragment_(*channel, *source, frags);
+		if (++made >= fragmentsPerCall_ || std::chrono::steady_clock::now() - start >= callTimeBudget_) break;
+
+		bool waiting = false;
+		source = takeBurst_(channel, waiting);
+	}
+	return true;
+}
+
+demo::UDPReceiver::Source* demo::UDPReceiver::takeBurst_(ReceiveChannel*& channel, bool& waiting)
+{
+	// Take a burst from each channel in turn, so that a busy one can't starve
+	// the others
+	for (size_t ii = 0; ii < channels_.size(); ++ii)
+	{
+		ReceiveChannel& candidate = *channels_[nextChannel_];
+		nextChannel_ = (nextChannel_ + 1) % channels_.size();
+		Source* source = nextBurst_(candidate);
+		if (source != nullptr)
+		{
+			channel = &candidate;
+			return source;
+		}
+		for (auto& known : candidate.sources)
+		{
+			if (known->window.holding()) { waiting = true; }
+		}
+	}
+	return nullptr;
+}
+
+void demo::UDPReceiver::makeFragment_(ReceiveChannel& channel, Source& source, artdaq::FragmentPtrs& frags)
+{
+	// Record the sender, so that the bursts of different senders can be told
+	// apart downstream
 	demo::UDPFragment::Metadata metadata;
-	metadata.port = dataport_;
-	metadata.address = si_data_.sin_addr.s_addr;
+	metadata.port = source.port;
+	metadata.address = source.address;
 
 	// And use it, along with the artdaq::Fragment header information
 	// (fragment id, sequence id, and user type) to create a fragment
@@ -87,164 +443,999 @@ bool demo::UDPReceiver::getNext_(artdaq::FragmentPtrs& frags)
 	frags.emplace_back(artdaq::Fragment::FragmentBytes(initial_payload_size,
 	                                                   ev_counter(), fragment_id(),
 	                                                   artdaq::Fragment::FirstUserFragmentType, metadata));
+	ev_counter_inc(); // from base CommandableFragmentGenerator
 	// We now have a fragment to contain this event:
 	demo::UDPFragmentWriter thisFrag(*frags.back());
 
-	bool haveData = false;
-	int16_t burst_end = -1;
-	uint8_t droppedPackets = 0;
-	while (!haveData)
+	PacketPool& pool = channel.pool;
+	std::vector<uint32_t> const& burst = source.window.burst();
+	uint8_t* firstPacket = pool.data(burst.front());
+	PacketPool::SlotHeader const& firstHeader = pool.header(burst.front());
+	if (firstHeader.kernelTime != 0)
+	{
+		assemblyTime_.add(nowNs() - firstHeader.kernelTime);
+	}
+
+	// Window and Buffer requests pick fragments by timestamp, from the data
+	// buffer of CommandableFragmentGenerator
+	switch (timestampSource_)
+	{
+	case TimestampSource::None:
+		break;
+	case TimestampSource::Kernel:
+		frags.back()->setTimestamp(firstHeader.kernelTime != 0 ? firstHeader.kernelTime : firstHeader.receiveTime);
+		break;
+	case TimestampSource::Receive:
+		frags.back()->setTimestamp(firstHeader.receiveTime);
+		break;
+	case TimestampSource::Payload:
+		if (firstHeader.size >= headerBytes_ + payloadTimestampOffset_ + sizeof(uint64_t))
+		{
+			uint64_t timestamp = 0;
+			for (size_t ii = 0; ii < sizeof(uint64_t); ++ii)
+			{
+				timestamp = (timestamp << 8) | firstPacket[headerBytes_ + payloadTimestampOffset_ + ii];
+			}
+			frags.back()->setTimestamp(timestamp);
+		}
+		else
+		{
+			mf::LogWarning("UDPReceiver") << "Burst from " << sourceName(source.address, source.port) << " is too short to hold a timestamp at payload_timestamp_offset";
+		}
+		break;
+	}
+	uint32_t firstSequence = protocolVersion_ == 2 ? UDPHeader::readV2(firstPacket).sequence : firstPacket[1];
+	mf::LogDebug("UDPReceiver") << "Recieved data, now placing data with UDP sequence number " << firstSequence << " into UDPFragment";
+
+	DataType dataType = getDataType(firstPacket[0]);
+	thisFrag.set_hdr_type((int)dataType);
+	bool terminated = dataType == DataType::JSON || dataType == DataType::String;
+
+	// Everything after the header of each datagram goes into the fragment.
+	// String types stop at the first NUL in each datagram. Work out how much
+	// that is first, so that the fragment is sized exactly.
+	size_t payloadSize = 0;
+	for (uint32_t packet : burst)
+	{
+		PacketPool::SlotHeader& header = pool.header(packet);
+		size_t size = header.size - headerBytes_;
+		if (terminated)
+		{
+			void* nul = memchr(pool.data(packet) + headerBytes_, 0, size);
+			if (nul != nullptr) size = static_cast<uint8_t*>(nul) - (pool.data(packet) + headerBytes_);
+		}
+		header.size = size + headerBytes_;
+		payloadSize += size;
+	}
+
+	// With json_index, leave room after the text for the largest index, and
+	// trim to what it turns out to need once the text is in place
+	bool indexed = terminated && jsonIndex_;
+	size_t indexOffset = JsonIndex::offset(payloadSize);
+	thisFrag.resize(indexed ? indexOffset + JsonIndex::bytes(jsonIndexMaxEntries_) : payloadSize + (terminated ? 1 : 0));
+	uint8_t* pos = thisFrag.dataBegin();
+	for (uint32_t packet : burst)
+	{
+		memcpy(pos, pool.data(packet) + headerBytes_, pool.header(packet).size - headerBytes_);
+		pos += pool.header(packet).size - headerBytes_;
+	}
+	source.window.releaseBurst();
+	releaseWindowSlots_(channel, source.window);
+	if (terminated)
+	{
+		*pos = 0;
+	}
+	if (indexed)
+	{
+		memset(pos, 0, indexOffset - payloadSize);
+		const char* text = reinterpret_cast<const char*>(thisFrag.dataBegin());
+		size_t indexBytes = JsonIndex::build(text, payloadSize, thisFrag.dataBegin() + indexOffset, jsonIndexMaxEntries_);
+		if (indexBytes != 0)
+		{
+			thisFrag.resize(indexOffset + indexBytes);
+		}
+		else
+		{
+			// String bursts need not be JSON; a JSON one that isn't is worth counting
+			thisFrag.resize(payloadSize + 1);
+			if (dataType == DataType::JSON) ++unindexedJson_;
+		}
+	}
+
+	if (rawOutput_)
+	{
+		rawWriter_.write(thisFrag.dataBegin(), payloadSize + (terminated ? 1 : 0));
+	}
+}
+
+demo::UDPReceiver::Source* demo::UDPReceiver::nextBurst_(ReceiveChannel& channel)
+{
+	// Datagrams stay in their pool slots until the burst they belong to has
+	// been copied into the fragment; only their indices move around. Each
+	// sender has a window, which puts its datagrams back in sequence order and
+	// says when a burst is complete.
+	auto now = std::chrono::steady_clock::now();
+
+	// The source whose burst went out last may have its next one complete already
+	if (channel.current != nullptr && burstReady_(channel, *channel.current, now))
+	{
+		return channel.current;
+	}
+
+	while (true)
 	{
-		if (should_stop())
+		// With many senders, looking through every window for a gap to give up
+		// on is not free. Do it when there is nothing else to do, and otherwise
+		// once per reorder_timeout_ms.
+		if (channel.pendingPacket == PacketPool::npos && (channel.ring.readable() == 0 || now - channel.lastSweep >= reorderTimeout_))
+		{
+			// What is still in the ring may be what a window is waiting for.
+			// Only the time up to the oldest of it has gone by without news.
+			auto asOf = now;
+			if (channel.ring.readable() != 0)
+			{
+				uint64_t arrived = channel.pool.header(channel.ring.consumerSlot(0)).receiveTime;
+				uint64_t realNow = nowNs();
+				if (arrived < realNow) asOf -= std::chrono::nanoseconds(realNow - arrived);
+			}
+			channel.lastSweep = now;
+			Source* ready = sweepGaps_(channel, asOf);
+			if (ready != nullptr)
+			{
+				return channel.current = ready;
+			}
+		}
+
+		if (channel.pendingPacket == PacketPool::npos)
 		{
+			if (channel.ring.readable() == 0)
+			{
+				reclaimSlots_(channel);
+				return nullptr;
+			}
+			channel.pendingPacket = channel.ring.consumerSlot(0);
+			channel.ring.consume(1);
+			now = std::chrono::steady_clock::now();
+
+			PacketPool::SlotHeader const& header = channel.pool.header(channel.pendingPacket);
+			if (header.kernelTime != 0 && header.receiveTime > header.kernelTime)
+			{
+				queueTime_.add(header.receiveTime - header.kernelTime);
+			}
+		}
+
+		uint32_t packet = channel.pendingPacket;
+		uint8_t* buffer = channel.pool.data(packet);
+		PacketPool::SlotHeader& header = channel.pool.header(packet);
+		uint32_t sequence = buffer[1];
+		bool valid = header.size >= headerBytes_;
+		if (valid && protocolVersion_ == 2)
+		{
+			UDPHeader wire = UDPHeader::readV2(buffer);
+			valid = wire.version == 2 && wire.payloadLength <= header.size - headerBytes_;
+			sequence = wire.sequence;
+
+			// Anything past the declared payload is padding
+			header.size = headerBytes_ + wire.payloadLength;
+		}
+		if (!valid)
+		{
+			mf::LogDebug("UDPReceiver") << "Discarding UDP packet without a valid protocol version " << protocolVersion_ << " header";
+			++channel.malformed;
+			channel.pendingPacket = PacketPool::npos;
+			releasePacket_(channel, packet);
+			continue;
+		}
+
+		Source* source = findSource_(channel, header);
+		if (source == nullptr)
+		{
+			++channel.unknownSources;
+			channel.pendingPacket = PacketPool::npos;
+			releasePacket_(channel, packet);
+			continue;
+		}
+
+		mf::LogDebug("UDPReceiver") << "Recieved UDP Packet with sequence number " << std::hex << sequence << " from " << sourceName(source->address, source->port) << "!";
+
+		uint8_t flags = 0;
+		switch (getReturnCode(buffer[0]))
+		{
+		case ReturnCode::Read: flags = ReorderWindow::BurstStart | ReorderWindow::BurstEnd; break;
+		case ReturnCode::First: flags = ReorderWindow::BurstStart; break;
+		case ReturnCode::Last: flags = ReorderWindow::BurstEnd; break;
+		default: break;
+		}
+
+		switch (source->window.insert(sequence, packet, flags))
+		{
+		case ReorderWindow::Result::Inserted:
+			break;
+		case ReorderWindow::Result::Overflow:
+			// Too far ahead to wait for the gap to be filled. Keep the packet
+			// in pendingPacket and try it again once the gap is skipped.
+			mf::LogDebug("UDPReceiver") << "Dropped packets detected before sequence number " << std::hex << sequence << " from " << sourceName(source->address, source->port);
+			source->window.skipGap();
+			if (burstReady_(channel, *source, now))
+			{
+				return channel.current = source;
+			}
+			continue;
+		case ReorderWindow::Result::Duplicate:
+			mf::LogDebug("UDPReceiver") << "Duplicate packet with sequence number " << std::hex << sequence << " from " << sourceName(source->address, source->port) << " discarded";
+			releasePacket_(channel, packet);
+			break;
+		case ReorderWindow::Result::Late:
+			mf::LogDebug("UDPReceiver") << "Out-of-sequence packet from " << sourceName(source->address, source->port) << " detected and discarded!";
+			releasePacket_(channel, packet);
+			break;
+		}
+		channel.pendingPacket = PacketPool::npos;
+
+		if (burstReady_(channel, *source, now))
+		{
+			return channel.current = source;
+		}
+	}
+}
+
+bool demo::UDPReceiver::burstReady_(ReceiveChannel& channel, Source& source, std::chrono::steady_clock::time_point now)
+{
+	bool ready = source.window.nextBurst();
+	while (ready && protocolVersion_ == 2 && !checkBurstID_(channel, source))
+	{
+		source.window.releaseBurst();
+		ready = source.window.nextBurst();
+	}
+	releaseWindowSlots_(channel, source.window);
+
+	// A gap, or a burst that has not ended, is only given up on once nothing
+	// has moved for reorder_timeout_ms. A window holding nothing keeps no one
+	// waiting, so its clock starts again.
+	if (source.window.head() != source.lastWindowHead || !source.window.holding())
+	{
+		source.lastWindowHead = source.window.head();
+		source.lastWindowProgress = now;
+	}
+	return ready;
+}
+
+bool demo::UDPReceiver::checkBurstID_(ReceiveChannel& channel, Source& source)
+{
+	// If the end of one burst and the start of the next are both lost, the
+	// window can't tell, and joins what is left of the two. Their burst IDs
+	// differ.
+	std::vector<uint32_t> const& burst = source.window.burst();
+	uint32_t burstID = UDPHeader::readV2(channel.pool.data(burst.front())).burstID;
+	for (uint32_t packet : burst)
+	{
+		if (UDPHeader::readV2(channel.pool.data(packet)).burstID != burstID)
+		{
+			mf::LogDebug("UDPReceiver") << "Discarding burst from " << sourceName(source.address, source.port) << " made of datagrams from different bursts";
+			++source.mixedBursts;
 			return false;
 		}
-		struct pollfd ufds[1];
-		ufds[0].fd = datasocket_;
-		ufds[0].events = POLLIN | POLLPRI;
+	}
 
-		int rv = poll(ufds, 1, 1000);
-		if (rv > 0)
+	// Bursts come out of the window in order, so skipped IDs were lost. A
+	// step backwards means that the sender has started again.
+	uint32_t skipped = burstID - source.nextBurstID;
+	if (source.burstIDKnown && skipped < 0x80000000)
+	{
+		source.lostBursts += skipped;
+	}
+	source.burstIDKnown = true;
+	source.nextBurstID = burstID + 1;
+	return true;
+}
+
+demo::UDPReceiver::Source* demo::UDPReceiver::sweepGaps_(ReceiveChannel& channel, std::chrono::steady_clock::time_point now)
+{
+	for (auto& source : channel.sources)
+	{
+		if (!source->window.holding() || now - source->lastWindowProgress < reorderTimeout_) continue;
+
+		// Either a datagram is missing, or the rest of a burst is
+		if (source->window.empty())
+		{
+			mf::LogDebug("UDPReceiver") << "Gave up waiting for the end of a burst from " << sourceName(source->address, source->port);
+			source->window.abandonBurst();
+		}
+		else
 		{
-			//std::cout << "revents: " << ufds[0].revents << ", " << ufds[1].revents << std::endl;
-			if (ufds[0].revents == POLLIN || ufds[0].revents == POLLPRI)
+			mf::LogDebug("UDPReceiver") << "Gave up waiting for UDP packet with sequence number " << std::hex << source->window.head() << " from " << sourceName(source->address, source->port);
+			source->window.skipGap();
+		}
+		if (burstReady_(channel, *source, now))
+		{
+			return source.get();
+		}
+	}
+	return nullptr;
+}
+
+void demo::UDPReceiver::reclaimSlots_(ReceiveChannel& channel)
+{
+	// With the ring empty, every slot that isn't free is held by a window.
+	// Bursts that are never finished, or that are finished only after more
+	// datagrams than there are slots, would hold them for good, and the
+	// receive thread would drop everything after.
+	size_t lowWater = std::max(std::min(channel.batchMsgs.size(), channel.pool.slots() / 4), size_t(1));
+	if (channel.freeSlots.size() >= lowWater) return;
+
+	Source* longest = nullptr;
+	for (auto& source : channel.sources)
+	{
+		if (longest == nullptr || source->window.burst().size() > longest->window.burst().size())
+		{
+			longest = source.get();
+		}
+	}
+	if (longest != nullptr && longest->window.abandonBurst())
+	{
+		releaseWindowSlots_(channel, longest->window);
+	}
+}
+
+demo::UDPReceiver::Source* demo::UDPReceiver::findSource_(ReceiveChannel& channel, PacketPool::SlotHeader const& header)
+{
+	uint64_t key = (uint64_t(header.sourceAddress) << 16) | header.sourcePort;
+	uint32_t index = channel.sourceIndex.find(key);
+	if (index != FlatIndex::npos)
+	{
+		return channel.sources[index].get();
+	}
+
+	if (channel.sources.size() >= maxSources_)
+	{
+		return nullptr;
+	}
+	mf::LogInfo("UDPReceiver") << "Receiving from new sender " << sourceName(header.sourceAddress, header.sourcePort);
+	channel.sourceIndex.insert(key, channel.sources.size());
+	channel.sources.emplace_back(new Source(header.sourceAddress, header.sourcePort, channel.windowSize, channel.sequenceMask, channel.maxBurst));
+	return channel.sources.back().get();
+}
+
+void demo::UDPReceiver::receiveLoop_(ReceiveChannel& channel)
+{
+	PacketPool& pool = channel.pool;
+	uint64_t lastData = 0;
+	while (receiving_)
+	{
+		// Within spin_us of the last datagram, try the socket again straight
+		// away rather than sleeping in poll, so that the next one is taken
+		// without waiting for the scheduler.
+		uint64_t now = spinTime_.count() > 0 ? steadyNs() : 0;
+		bool spinning = now - lastData < uint64_t(spinTime_.count());
+		if (!spinning)
+		{
+			struct pollfd ufds[2];
+			ufds[0].fd = channel.socket;
+			ufds[0].events = POLLIN | POLLPRI;
+			ufds[1].fd = receiveStop_.fd();
+			ufds[1].events = POLLIN;
+
+			// stopReceiving_ wakes us through receiveStop_
+			int rv = poll(ufds, 2, -1);
+			if (rv <= 0 || !(ufds[0].revents & (POLLIN | POLLPRI)))
+			{
+				continue;
+			}
+		}
+
+		// If getNext_ has fallen so far behind that every slot is in use, keep
+		// the socket drained anyway, and count what we throw away.
+		size_t room = std::min(channel.freeSlots.readable(), channel.batchMsgs.size());
+		bool discard = room == 0;
+		size_t want = discard ? channel.batchMsgs.size() : room;
+		for (size_t ii = 0; ii < want; ++ii)
+		{
+			channel.batchIovecs[ii].iov_base = discard ? &channel.discardBuffer[0] : pool.slotData(channel.freeSlots.consumerSlot(ii));
+			channel.batchIovecs[ii].iov_len = discard ? channel.discardBuffer.size() : pool.slotBytes();
+		}
+
+		prepareControl_(channel, want);
+
+		// Take everything that is waiting, up to receive_batch_size, in one
+		// system call. Unless spinning, the poll above means there is at least
+		// one datagram.
+		int count = recvmmsg(channel.socket, &channel.batchMsgs[0], want, MSG_DONTWAIT, nullptr);
+		uint64_t receiveTime = nowNs();
+		if (count <= 0)
+		{
+			if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				mf::LogWarning("UDPReceiver") << "recvmmsg failed: " << strerror(errno);
+			}
+			if (spinning)
+			{
+				channel.spinTime.fetch_add(steadyNs() - now, std::memory_order_relaxed);
+			}
+			continue;
+		}
+		if (spinTime_.count() > 0) lastData = steadyNs();
+
+		if (discard)
+		{
+			for (int ii = 0; ii < count; ++ii)
+			{
+				size_t segmentSize = 0;
+				readControl_(channel, channel.batchMsgs[ii].msg_hdr, segmentSize);
+				size_t length = channel.batchMsgs[ii].msg_len;
+				channel.ringOverflows += segmentSize > 0 ? (length + segmentSize - 1) / segmentSize : 1;
+			}
+			continue;
+		}
+
+		// A datagram longer than max_datagram_size is no use; without UDP_GRO,
+		// it has also lost its end. Its slot is swapped behind the good ones, so
+		// that it stays free.
+		size_t kept = 0;
+		size_t published = 0;
+		for (int ii = 0; ii < count; ++ii)
+		{
+			struct msghdr& msg = channel.batchMsgs[ii].msg_hdr;
+			size_t segmentSize = 0;
+			uint64_t kernelTime = readControl_(channel, msg, segmentSize);
+			size_t length = channel.batchMsgs[ii].msg_len;
+			if (segmentSize == 0) segmentSize = std::max(length, size_t(1));
+			size_t segments = (length + segmentSize - 1) / segmentSize;
+			if ((msg.msg_flags & MSG_TRUNC) || segmentSize > maxDatagramSize_)
+			{
+				channel.truncated += std::max(segments, size_t(1));
+				continue;
+			}
+			std::swap(channel.freeSlots.consumerSlot(kept), channel.freeSlots.consumerSlot(ii));
+
+			// The datagrams stay where the kernel put them, one after another.
+			// Only the first size bytes of each are meaningful; whatever an
+			// earlier receive left beyond that is never looked at.
+			uint32_t slot = channel.freeSlots.consumerSlot(kept);
+			segments = std::max(segments, size_t(1));
+			for (size_t segment = 0; segment < segments; ++segment)
 			{
-				uint8_t peekBuffer[2];
-				recvfrom(datasocket_, peekBuffer, sizeof(peekBuffer), MSG_PEEK,
-				         (struct sockaddr *) &si_data_, (socklen_t*)sizeof(si_data_));
-
-				mf::LogInfo("UDPReceiver") << "Recieved UDP Packet with sequence number " << std::hex << (int)peekBuffer[1] << "!";
-				//std::cout << "peekBuffer[1] == expectedPacketNumber_: " << std::hex << (int)peekBuffer[1] << " =?= " << (int)expectedPacketNumber_ << std::endl;
-
-				uint8_t seqNum = peekBuffer[1];
-				ReturnCode dataCode = getReturnCode(peekBuffer[0]);
-				if (seqNum >= expectedPacketNumber_ || (seqNum < 10 && expectedPacketNumber_ > 200) || droppedPackets > 0 || expectedPacketNumber_ - seqNum > 20)
-				{
-					if (seqNum != expectedPacketNumber_ && (seqNum >= expectedPacketNumber_ || (seqNum < 10 && expectedPacketNumber_ > 200)))
-					{
-						int deltaHi = seqNum - expectedPacketNumber_;
-						int deltaLo = 255 + seqNum - expectedPacketNumber_;
-						droppedPackets += deltaLo < 255 ? deltaLo : deltaHi;
-						mf::LogWarning("UDPReceiver") << "Dropped/Delayed packets detected: " << std::to_string(droppedPackets) << std::endl;
-						expectedPacketNumber_ = seqNum;
-					}
-					else if (seqNum != expectedPacketNumber_)
-					{
-						int delta = expectedPacketNumber_ - seqNum;
-						mf::LogWarning("UDPReceiver") << "Sequence Number significantly different than expected! (delta: " << delta << ")";
-					}
-
-					if (dataCode == ReturnCode::Read || dataCode == ReturnCode::First)
-					{
-						packetBuffers_.clear();
-						packetBuffer_t buffer;
-						memset(&buffer[0], 0, sizeof(packetBuffer_t));
-						recvfrom(datasocket_, &buffer[0], sizeof(packetBuffer_t), 0, (struct sockaddr *) &si_data_, (socklen_t*)sizeof(si_data_));
-						packetBuffers_.push_back(buffer);
-						mf::LogDebug("UDPReceiver") << "Now placing UDP packet with sequence number " << std::hex << (int)seqNum << " into buffer.";
-						if (dataCode == ReturnCode::Read) { haveData = true; }
-						else
-						{
-							droppedPackets = 0;
-							burst_end = -1;
-						}
-					}
-					else if ((dataCode == ReturnCode::Middle || dataCode == ReturnCode::Last) && packetBuffers_.size() > 0)
-					{
-						packetBuffer_t buffer;
-						memset(&buffer[0], 0, sizeof(packetBuffer_t));
-						recvfrom(datasocket_, &buffer[0], sizeof(packetBuffer_t), 0, (struct sockaddr *) &si_data_, (socklen_t*)sizeof(si_data_));
-						if (droppedPackets == 0)
-						{
-							packetBuffers_.push_back(buffer);
-						}
-						else if (burst_end == -1 || seqNum < burst_end)
-						{
-							bool found = false;
-							for (packetBuffer_list_t::iterator it = packetBuffers_.begin(); it != packetBuffers_.end(); ++it)
-							{
-								if (seqNum < (*it)[1])
-								{
-									packetBuffers_.insert(it, buffer);
-									droppedPackets--;
-									expectedPacketNumber_--;
-								}
-							}
-							if (!found)
-							{
-								packetBuffers_.push_back(buffer);
-							}
-						}
-						mf::LogDebug("UDPReceiver") << "Now placing UDP packet with sequence number " << std::hex << (int)seqNum << " into buffer.";
-						if (dataCode == ReturnCode::Last && droppedPackets == 0)
-						{
-							while (getReturnCode(packetBuffers_.back()[0]) != ReturnCode::Last) { packetBuffers_.pop_back(); }
-							haveData = true;
-						}
-						else if (dataCode == ReturnCode::Last) { burst_end = seqNum; }
-						else if (burst_end >= 0 && droppedPackets == 0)
-						{
-							while (getReturnCode(packetBuffers_.back()[0]) != ReturnCode::Last) { packetBuffers_.pop_back(); }
-							haveData = true;
-						}
-					}
-
-					++expectedPacketNumber_;
-				}
-				else
-				{
-					packetBuffer_t discardBuffer;
-					recvfrom(datasocket_, &discardBuffer[0], sizeof(discardBuffer), 0, (struct sockaddr *) &si_data_, (socklen_t*)sizeof(si_data_));
-					mf::LogWarning("UDPReceiver") << "Out-of-sequence packet detected and discarded!";
-				}
+				uint32_t packet = pool.packet(slot, segment);
+				PacketPool::SlotHeader& header = pool.header(packet);
+				header.offset = segment * segmentSize;
+				header.size = std::min(segmentSize, length - header.offset);
+				header.sourceAddress = channel.batchAddrs[ii].sin_addr.s_addr;
+				header.sourcePort = ntohs(channel.batchAddrs[ii].sin_port);
+				header.receiveTime = receiveTime;
+				header.kernelTime = kernelTime;
+				channel.ring.producerSlot(published++) = packet;
 			}
+			pool.hold(slot, segments);
+			++kept;
 		}
+		channel.freeSlots.consume(kept);
+		publish_(channel, published);
 	}
+}
 
-	packetBuffer_t& firstPacket = packetBuffers_.front();
-	mf::LogDebug("UDPReceiver") << "Recieved data, now placing data with UDP sequence number " << (int)firstPacket[1] << " into UDPFragment";
-	thisFrag.resize(1500 * packetBuffers_.size() + 1);
-	std::ofstream output;
-	if (rawOutput_)
+void demo::UDPReceiver::replayLoop_(ReceiveChannel& channel)
+{
+	PcapReader reader;
+	if (!reader.open(pcapFile_))
 	{
-		std::string outputPath = rawPath_ + "/UDPReceiver-" + ip_ + ":" + std::to_string(dataport_) + ".bin";
-		output.open(outputPath, std::ios::out | std::ios::app | std::ios::binary);
+		mf::LogError("UDPReceiver") << "Cannot replay pcap_file: " << reader.error();
+		return;
 	}
 
-	DataType dataType = getDataType(firstPacket[0]);
-	thisFrag.set_hdr_type((int)dataType);
-	int pos = 0;
-	for (auto jj : packetBuffers_)
+	PacketPool& pool = channel.pool;
+	PcapReader::Datagram datagram;
+	uint64_t firstCapture = 0;
+	uint64_t replayStart = 0;
+	uint64_t replayed = 0;
+	size_t published = 0;
+	while (receiving_ && reader.next(datagram))
 	{
-		for (int ii = 2; ii < 1500; ++ii)
+		if (pcapPort_ != 0 && datagram.destinationPort != pcapPort_) continue;
+		if (datagram.size > maxDatagramSize_)
 		{
-			// Null-terminate string types
-			if (jj[ii] == 0 && (dataType == DataType::JSON || dataType == DataType::String)) { break; }
+			++channel.truncated;
+			continue;
+		}
 
-			if (rawOutput_) output.write((char*)&(jj[ii]), sizeof(uint8_t));
-			*(thisFrag.dataBegin() + pos) = jj[ii];
-			++pos;
+		// Keep the captured spacing, sped up by pcap_speed. Whatever is ready
+		// goes to getNext_ first.
+		if (pcapSpeed_ > 0 && datagram.time != 0)
+		{
+			if (replayStart == 0)
+			{
+				firstCapture = datagram.time;
+				replayStart = steadyNs();
+			}
+			uint64_t offset = datagram.time > firstCapture ? datagram.time - firstCapture : 0;
+			uint64_t due = replayStart + uint64_t(offset / pcapSpeed_);
+			uint64_t now = steadyNs();
+			if (now < due)
+			{
+				publish_(channel, published);
+				published = 0;
+				if (receiveStop_.wait(std::chrono::microseconds((due - now) / 1000))) break;
+			}
+		}
+
+		// Wait for getNext_ to free a slot, rather than drop the datagram
+		while (channel.freeSlots.readable() == 0 && receiving_)
+		{
+			publish_(channel, published);
+			published = 0;
+			receiveStop_.wait(std::chrono::microseconds(100));
+		}
+		if (!receiving_) break;
+
+		uint32_t slot = channel.freeSlots.consumerSlot(0);
+		channel.freeSlots.consume(1);
+		memcpy(pool.slotData(slot), datagram.data, datagram.size);
+		uint32_t packet = pool.packet(slot, 0);
+		PacketPool::SlotHeader& header = pool.header(packet);
+		header.offset = 0;
+		header.size = datagram.size;
+		header.sourceAddress = datagram.sourceAddress;
+		header.sourcePort = datagram.sourcePort;
+		header.receiveTime = nowNs();
+		header.kernelTime = 0;
+		pool.hold(slot, 1);
+		channel.ring.producerSlot(published++) = packet;
+		++replayed;
+
+		if (published == channel.batchMsgs.size())
+		{
+			publish_(channel, published);
+			published = 0;
 		}
 	}
-	if (dataType == DataType::JSON || dataType == DataType::String)
+	publish_(channel, published);
+
+	if (!reader.error().empty())
+	{
+		mf::LogError("UDPReceiver") << "Stopped replaying " << pcapFile_ << ": " << reader.error();
+	}
+	mf::LogInfo("UDPReceiver") << "Replayed " << replayed << " datagrams from " << pcapFile_ << "; " << reader.skipped()
+	                           << " frames were not whole IPv4 UDP datagrams";
+}
+
+void demo::UDPReceiver::publish_(ReceiveChannel& channel, size_t count)
+{
+	if (count == 0) return;
+
+	channel.lastPublish.store(steadyNs(), std::memory_order_relaxed);
+	channel.ring.publish(count);
+
+	size_t depth = channel.pool.slots() - channel.freeSlots.readable();
+	if (depth > channel.ringHighWater.load(std::memory_order_relaxed))
+	{
+		channel.ringHighWater.store(depth, std::memory_order_relaxed);
+	}
+
+	// One wakeup per batch, not per datagram, and none at all if getNext_
+	// is awake to see the data anyway. The fence pairs with the one in
+	// waitForData_: either getNext_ sees this batch before it sleeps, or
+	// this thread sees that it is asleep.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (consumerWaiting_.load(std::memory_order_relaxed))
+	{
+		eventfd_write(dataReadyFd_, 1);
+	}
+}
+
+void demo::UDPReceiver::setReceiveBuffer_(int socket)
+{
+	if (receiveBufferSize_ == 0) return;
+
+	int size = static_cast<int>(std::min(receiveBufferSize_, size_t(INT_MAX / 2)));
+	if (!receiveBufferForce_ || setsockopt(socket, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0)
 	{
-		*(thisFrag.dataBegin() + pos) = 0;
-		char zero = 0;
-		if (rawOutput_) output.write(&zero, sizeof(char));
+		// Without CAP_NET_ADMIN, the kernel quietly caps this at net.core.rmem_max
+		if (setsockopt(socket, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) < 0)
+		{
+			mf::LogWarning("UDPReceiver") << "Cannot set socket receive buffer size: " << strerror(errno);
+			return;
+		}
 	}
-	if (rawOutput_) output.close();
 
+	// The kernel doubles the value asked for, to allow for its bookkeeping
+	int actual = 0;
+	socklen_t length = sizeof(actual);
+	getsockopt(socket, SOL_SOCKET, SO_RCVBUF, &actual, &length);
+	if (actual / 2 < size)
+	{
+		mf::LogWarning("UDPReceiver") << "Asked for a " << size << " byte socket receive buffer, but got " << actual / 2
+		                              << "; raise net.core.rmem_max, or give the process CAP_NET_ADMIN";
+	}
+	else
+	{
+		mf::LogInfo("UDPReceiver") << "Socket receive buffer is " << actual / 2 << " bytes";
+	}
+}
+
+void demo::UDPReceiver::prepareControl_(ReceiveChannel& channel, size_t count)
+{
+	// The kernel overwrites msg_controllen and msg_namelen with the lengths
+	// it used, so this has to be done before every call
+	for (size_t ii = 0; ii < count; ++ii)
+	{
+		struct msghdr& msg = channel.batchMsgs[ii].msg_hdr;
+		msg.msg_control = &channel.batchControl[ii * controlBytes];
+		msg.msg_controllen = controlBytes;
+		msg.msg_namelen = sizeof(struct sockaddr_in);
+	}
+}
+
+uint64_t demo::UDPReceiver::readControl_(ReceiveChannel& channel, struct msghdr& msg, size_t& segmentSize)
+{
+	uint64_t kernelTime = 0;
+	segmentSize = 0;
+	for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+	{
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+		{
+			struct timespec ts;
+			memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+			kernelTime = uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+		}
+		else if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+		{
+			// A running count for the socket, which wraps
+			uint32_t counter;
+			memcpy(&counter, CMSG_DATA(cmsg), sizeof(counter));
+			channel.kernelDrops += uint32_t(counter - channel.lastDropCounter);
+			channel.lastDropCounter = counter;
+		}
+		else if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+		{
+			int size;
+			memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+			segmentSize = size > 0 ? size : 0;
+		}
+	}
+	return kernelTime;
+}
+
+void demo::UDPReceiver::drainSocket_(ReceiveChannel& channel)
+{
+	if (channel.socket < 0) return;
+
+	// Between runs nothing reads the socket, so it fills up and the kernel
+	// drops the rest. Neither belongs to the next run.
+	std::vector<uint8_t> control(controlBytes);
+	size_t stale = 0;
+	while (true)
+	{
+		struct iovec iov;
+		iov.iov_base = &channel.discardBuffer[0];
+		iov.iov_len = channel.discardBuffer.size();
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = &control[0];
+		msg.msg_controllen = control.size();
+		if (recvmsg(channel.socket, &msg, MSG_DONTWAIT) < 0)
+		{
+			if (errno == EINTR) continue;
+			break;
+		}
+		++stale;
+		for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		{
+			if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+			{
+				memcpy(&channel.lastDropCounter, CMSG_DATA(cmsg), sizeof(channel.lastDropCounter));
+			}
+		}
+	}
+
+	// Drops after the last queued datagram came with no datagram to report
+	// them; the socket knows its running count
+#ifdef SO_MEMINFO
+	uint32_t meminfo[SK_MEMINFO_VARS];
+	socklen_t length = sizeof(meminfo);
+	if (getsockopt(channel.socket, SOL_SOCKET, SO_MEMINFO, meminfo, &length) == 0 && length > SK_MEMINFO_DROPS * sizeof(uint32_t))
+	{
+		channel.lastDropCounter = meminfo[SK_MEMINFO_DROPS];
+	}
+#endif
+	if (stale > 0)
+	{
+		mf::LogDebug("UDPReceiver") << "Discarded " << stale << " datagrams received between runs";
+	}
+}
+
+void demo::UDPReceiver::startReceiving_()
+{
+	if (receiving_) return;
+	receiving_ = true;
+	receiveStop_.clear();
+	for (size_t ii = 0; ii < channels_.size(); ++ii)
+	{
+		ReceiveChannel& channel = *channels_[ii];
+		channel.thread = std::thread(pcapFile_.empty() ? &UDPReceiver::receiveLoop_ : &UDPReceiver::replayLoop_, this, std::ref(channel));
+		if (receiveCpus_.empty()) continue;
+
+		// Keeping a receive thread on one CPU keeps its caches warm, and, with
+		// the NIC interrupts steered to the same CPU, the data too
+		int cpu = receiveCpus_[ii % receiveCpus_.size()];
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		int error = pthread_setaffinity_np(channel.thread.native_handle(), sizeof(cpus), &cpus);
+		if (error != 0)
+		{
+			mf::LogWarning("UDPReceiver") << "Cannot pin receive thread " << ii << " to CPU " << cpu << ": " << strerror(error);
+		}
+	}
+}
+
+void demo::UDPReceiver::stopReceiving_()
+{
+	receiving_ = false;
+	receiveStop_.signal();
+	for (auto& channel : channels_)
+	{
+		if (channel->thread.joinable()) channel->thread.join();
+	}
+}
+
+void demo::UDPReceiver::waitForData_(int timeout_ms)
+{
+	uint64_t start = steadyNs();
+	ReceiveChannel* ready = nullptr;
+
+	// Spin for a while first; a burst that is about to arrive is then taken
+	// without a trip through the scheduler
+	uint64_t spin = std::min(uint64_t(spinTime_.count()), uint64_t(timeout_ms) * 1000000);
+	uint64_t now = start;
+	while (ready == nullptr && now - start < spin && !stopEvent_.signalled())
+	{
+		ready = dataReady_();
+		now = steadyNs();
+	}
+	consumerSpinTime_ += now - start;
+
+	if (ready == nullptr)
+	{
+		// Tell the receive threads to wake us, then look once more, so that
+		// data published in between isn't missed (see receiveLoop_)
+		consumerWaiting_.store(true, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		ready = dataReady_();
+		if (ready == nullptr)
+		{
+			// stopNoMutex and pauseNoMutex wake us through stopEvent_
+			stopEvent_.waitFor(dataReadyFd_, POLLIN, std::chrono::milliseconds(timeout_ms));
+			ready = dataReady_();
+		}
+		consumerWaiting_.store(false, std::memory_order_relaxed);
+
+		eventfd_t value;
+		eventfd_read(dataReadyFd_, &value);
+	}
+
+	if (ready != nullptr)
+	{
+		uint64_t published = ready->lastPublish.load(std::memory_order_relaxed);
+		uint64_t woken = steadyNs();
+		wakeupLatency_.add(woken > published ? woken - published : 0);
+	}
+}
+
+bool demo::UDPReceiver::stopping_()
+{
+	// stopNoMutex is called before should_stop() becomes true
+	if (!stopEvent_.signalled() && !should_stop())
+	{
+		return false;
+	}
+	if (metricMan != nullptr && stopEvent_.signalled())
+	{
+		metricMan->sendMetric("UDP Stop Latency", stopEvent_.sinceSignal().count() / 1e6, "ms", 1, artdaq::MetricMode::LastPoint);
+	}
 	return true;
 }
 
+demo::UDPReceiver::ReceiveChannel* demo::UDPReceiver::dataReady_()
+{
+	for (auto& channel : channels_)
+	{
+		if (channel->ring.readable() > 0) return channel.get();
+	}
+	return nullptr;
+}
+
+void demo::UDPReceiver::reportMetrics_()
+{
+	auto now = std::chrono::steady_clock::now();
+	if (std::chrono::duration<double>(now - lastMetricTime_).count() < metricInterval_) return;
+
+	double interval = std::chrono::duration<double>(now - lastMetricTime_).count();
+	uint64_t rawDropped = rawWriter_.dropped();
+	uint64_t spinTime = consumerSpinTime_;
+	size_t highWater = 0;
+	size_t sources = 0;
+	uint64_t overflows = 0, truncated = 0, kernelDrops = 0, lost = 0, late = 0, duplicates = 0, discarded = 0, unknownSources = 0, malformed = 0, lostBursts = 0, mixedBursts = 0, abandonedBursts = 0;
+	for (auto& channel : channels_)
+	{
+		highWater = std::max(highWater, channel->ringHighWater.exchange(0));
+		overflows += channel->ringOverflows.load();
+		truncated += channel->truncated.load();
+		kernelDrops += channel->kernelDrops.load();
+		spinTime += channel->spinTime.load(std::memory_order_relaxed);
+		unknownSources += channel->unknownSources;
+		malformed += channel->malformed;
+		sources += channel->sources.size();
+		for (auto& source : channel->sources)
+		{
+			lost += source->window.lost();
+			late += source->window.late();
+			duplicates += source->window.duplicates();
+			discarded += source->window.discarded();
+			lostBursts += source->lostBursts;
+			mixedBursts += source->mixedBursts;
+			abandonedBursts += source->window.abandoned();
+		}
+	}
+	if (metricMan != nullptr)
+	{
+		metricMan->sendMetric("UDP Raw Output Dropped", static_cast<unsigned long>(rawDropped - lastRawDropped_), "Bytes", 1, artdaq::MetricMode::Accumulate);
+		metricMan->sendMetric("UDP Ring High Water", static_cast<unsigned long>(highWater), "Packets", 2, artdaq::MetricMode::LastPoint);
+		metricMan->sendMetric("UDP Ring Overflows", static_cast<unsigned long>(overflows - lastRingOverflows_), "Packets", 1, artdaq::MetricMode::Accumulate);
+		metricMan->sendMetric("UDP Truncated Packets", static_cast<unsigned long>(truncated - lastTruncated_), "Packets", 1, artdaq::MetricMode::Accumulate);
+		// Kernel drops are also sequence gaps; gaps beyond them were lost on the network or by the sender
+		metricMan->sendMetric("UDP Kernel Drops", static_cast<unsigned long>(kernelDrops - lastKernelDrops_), "Packets", 1, artdaq::MetricMode::Accumulate);
+		metricMan->sendMetric("UDP Packets Lost", static_cast<unsigned long>(lost - lastLost_), "Packets", 1, artdaq::MetricMode::Accumulate);
+		metricMan->sendMetric("UDP Late Packets", static_cast<unsigned long>(late - lastLate_), "Packets", 2, artdaq::MetricMode::Accumulate);
+		metricMan->sendMetric("UDP Duplicate Packets", static_cast<unsigned long>(duplicates - lastDuplicates_), "Packets", 2, artdaq::MetricMode::Accumulate);
+		metricMan->sendMetric("UDP Discarded Packets", static_cast<unsigned long>(discarded - lastDiscarded_), "Packets", 1, artdaq::MetricMode::Accumulate);
+		metricMan->sendMetric("UDP Senders", static_cast<unsigned long>(sources), "Senders", 2, artdaq::MetricMode::LastPoint);
+		metricMan->sendMetric("UDP Unknown Sender Packets", static_cast<unsigned long>(unknownSources - lastUnknownSources_), "Packets", 1, artdaq::MetricMode::Accumulate);
+		metricMan->sendMetric("UDP Malformed Packets", static_cast<unsigned long>(malformed - lastMalformed_), "Packets", 1, artdaq::MetricMode::Accumulate);
+		metricMan->sendMetric("UDP Abandoned Bursts", static_cast<unsigned long>(abandonedBursts - lastAbandonedBursts_), "Bursts", 1, artdaq::MetricMode::Accumulate);
+		if (protocolVersion_ == 2)
+		{
+			metricMan->sendMetric("UDP Bursts Lost", static_cast<unsigned long>(lostBursts - lastLostBursts_), "Bursts", 1, artdaq::MetricMode::Accumulate);
+			metricMan->sendMetric("UDP Mixed Bursts", static_cast<unsigned long>(mixedBursts - lastMixedBursts_), "Bursts", 1, artdaq::MetricMode::Accumulate);
+		}
+		if (jsonIndex_)
+		{
+			metricMan->sendMetric("UDP Unindexed JSON", static_cast<unsigned long>(unindexedJson_ - lastUnindexedJson_), "Fragments", 1, artdaq::MetricMode::Accumulate);
+		}
+	}
+	if (truncated != lastTruncated_)
+	{
+		mf::LogWarning("UDPReceiver") << truncated - lastTruncated_ << " datagrams longer than max_datagram_size were dropped";
+	}
+	if (unknownSources != lastUnknownSources_)
+	{
+		mf::LogWarning("UDPReceiver") << unknownSources - lastUnknownSources_ << " datagrams were dropped because they came from more than max_sources senders";
+	}
+	if (abandonedBursts != lastAbandonedBursts_)
+	{
+		mf::LogWarning("UDPReceiver") << abandonedBursts - lastAbandonedBursts_ << " incomplete bursts were dropped because they were longer than max_burst_datagrams,"
+		                              << " did not end within reorder_timeout_ms, or held slots the receive thread needed";
+	}
+
+	// Sequence problems can come with every datagram, so they are only
+	// summed up here, once per metric_interval_s
+	if (lost != lastLost_ || late != lastLate_ || duplicates != lastDuplicates_ || malformed != lastMalformed_ || mixedBursts != lastMixedBursts_)
+	{
+		mf::LogWarning("UDPReceiver") << "In the last " << interval << " s: " << lost - lastLost_ << " datagrams lost, "
+		                              << late - lastLate_ << " arrived too late, " << duplicates - lastDuplicates_ << " duplicates, "
+		                              << malformed - lastMalformed_ << " malformed, and " << mixedBursts - lastMixedBursts_ << " bursts mixed from several";
+	}
+	if (metricMan != nullptr && queueTime_.count() > 0)
+	{
+		metricMan->sendMetric("UDP Time In Queue p50", queueTime_.percentile(0.5) / 1000.0, "us", 2, artdaq::MetricMode::LastPoint);
+		metricMan->sendMetric("UDP Time In Queue p99", queueTime_.percentile(0.99) / 1000.0, "us", 2, artdaq::MetricMode::LastPoint);
+		metricMan->sendMetric("UDP Time In Queue Max", queueTime_.max() / 1000.0, "us", 2, artdaq::MetricMode::LastPoint);
+	}
+	if (metricMan != nullptr && assemblyTime_.count() > 0)
+	{
+		metricMan->sendMetric("UDP Burst Assembly Time p50", assemblyTime_.percentile(0.5) / 1000.0, "us", 2, artdaq::MetricMode::LastPoint);
+		metricMan->sendMetric("UDP Burst Assembly Time p99", assemblyTime_.percentile(0.99) / 1000.0, "us", 2, artdaq::MetricMode::LastPoint);
+		metricMan->sendMetric("UDP Burst Assembly Time Max", assemblyTime_.max() / 1000.0, "us", 2, artdaq::MetricMode::LastPoint);
+	}
+	if (metricMan != nullptr && wakeupLatency_.count() > 0)
+	{
+		metricMan->sendMetric("UDP Wakeup Latency p50", wakeupLatency_.percentile(0.5) / 1000.0, "us", 2, artdaq::MetricMode::LastPoint);
+		metricMan->sendMetric("UDP Wakeup Latency p99", wakeupLatency_.percentile(0.99) / 1000.0, "us", 2, artdaq::MetricMode::LastPoint);
+		metricMan->sendMetric("UDP Wakeup Latency Max", wakeupLatency_.max() / 1000.0, "us", 2, artdaq::MetricMode::LastPoint);
+	}
+	if (metricMan != nullptr && spinTime_.count() > 0 && interval > 0)
+	{
+		// What spinning costs, in CPUs kept busy without finding data
+		metricMan->sendMetric("UDP Spin CPU", (spinTime - lastSpinTime_) / 1e9 / interval, "CPUs", 2, artdaq::MetricMode::LastPoint);
+	}
+	queueTime_.clear();
+	assemblyTime_.clear();
+	wakeupLatency_.clear();
+
+	lastMetricTime_ = now;
+	lastSpinTime_ = spinTime;
+	lastRingOverflows_ = overflows;
+	lastTruncated_ = truncated;
+	lastKernelDrops_ = kernelDrops;
+	lastRawDropped_ = rawDropped;
+	lastLost_ = lost;
+	lastLate_ = late;
+	lastDuplicates_ = duplicates;
+	lastDiscarded_ = discarded;
+	lastUnknownSources_ = unknownSources;
+	lastMalformed_ = malformed;
+	lastLostBursts_ = lostBursts;
+	lastMixedBursts_ = mixedBursts;
+	lastAbandonedBursts_ = abandonedBursts;
+	lastUnindexedJson_ = unindexedJson_;
+}
+
+void demo::UDPReceiver::releasePacket_(ReceiveChannel& channel, uint32_t packet)
+{
+	uint32_t slot = channel.pool.slotOf(packet);
+	if (!channel.pool.release(slot)) return;
+
+	// freeSlots has room for every slot in the pool, so this can't overflow
+	channel.freeSlots.producerSlot(0) = slot;
+	channel.freeSlots.publish(1);
+}
+
+void demo::UDPReceiver::releaseWindowSlots_(ReceiveChannel& channel, ReorderWindow& window)
+{
+	for (uint32_t packet : window.released())
+	{
+		releasePacket_(channel, packet);
+	}
+	window.clearReleased();
+}
+
 void demo::UDPReceiver::start()
 {
+	stopEvent_.clear();
+
+	// Anything left over from the last run is stale. The senders are kept:
+	// they are most likely the same ones.
+	for (auto& channel : channels_)
+	{
+		for (auto& source : channel->sources)
+		{
+			source->window.clear();
+			releaseWindowSlots_(*channel, source->window);
+			source->burstIDKnown = false;
+		}
+		channel->current = nullptr;
+		if (channel->pendingPacket != PacketPool::npos)
+		{
+			releasePacket_(*channel, channel->pendingPacket);
+			channel->pendingPacket = PacketPool::npos;
+		}
+		for (size_t ii = 0; ii < channel->ring.readable(); ++ii)
+		{
+			releasePacket_(*channel, channel->ring.consumerSlot(ii));
+		}
+		channel->ring.consume(channel->ring.readable());
+		drainSocket_(*channel);
+	}
+
+	if (rawOutput_ && !rawWriter_.open(rawPath_ + "/UDPReceiver-" + ip_ + ":" + std::to_string(dataport_)))
+	{
+		mf::LogError("UDPReceiver") << "Cannot open raw output file in " << rawPath_ << ": " << strerror(errno) << "; raw output is disabled for this run";
+	}
+
+	startReceiving_();
 	send(CommandType::Start_Burst);
 }
 
 void demo::UDPReceiver::stop()
 {
 	send(CommandType::Stop_Burst);
+	stopReceiving_();
+	rawWriter_.close();
+}
+
+void demo::UDPReceiver::stopNoMutex()
+{
+	// Called without the mutex that getNext_ may be holding while it waits
+	stopEvent_.signal();
 }
 
 void demo::UDPReceiver::pause()
@@ -252,19 +1443,25 @@ void demo::UDPReceiver::pause()
 	send(CommandType::Stop_Burst);
 }
 
+void demo::UDPReceiver::pauseNoMutex()
+{
+	stopEvent_.signal();
+}
+
 void demo::UDPReceiver::resume()
 {
+	stopEvent_.clear();
 	send(CommandType::Start_Burst);
 }
 
 void demo::UDPReceiver::send(CommandType command)
 {
-	if (sendCommands_)
+	if (sendCommands_ && channels_[0]->socket >= 0)
 	{
 		CommandPacket packet;
 		packet.type = command;
 		packet.dataSize = 0;
-		sendto(datasocket_, &packet, sizeof(packet), 0, (struct sockaddr *) &si_data_, sizeof(si_data_));
+		sendto(channels_[0]->socket, &packet, sizeof(packet), 0, (struct sockaddr *) &si_data_, sizeof(si_data_));
 	}
 }
 
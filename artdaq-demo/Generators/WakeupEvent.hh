@@ -0,0 +1,147 @@
+#ifndef artdaq_demo_Generators_WakeupEvent_hh
+#define artdaq_demo_Generators_WakeupEvent_hh
+
+#include "cetlib_except/exception.h"
+
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+namespace demo
+{
+	/**
+	 * \brief An eventfd that wakes a sleeping getNext_ as soon as the run is stopped or paused
+	 *
+	 * A generator signals it from stopNoMutex and pauseNoMutex, which the
+	 * framework calls before taking the generator's mutex, and includes fd()
+	 * in whatever it sleeps on while waiting for data. Once signalled it stays
+	 * readable until clear(), so that every later wait returns at once too.
+	 *
+	 * Note that stopNoMutex is called before should_stop() becomes true, so a
+	 * woken getNext_ must check signalled() as well as should_stop().
+	 */
+	class WakeupEvent
+	{
+	public:
+		/**
+		 * \brief WakeupEvent Constructor
+		 */
+		WakeupEvent()
+			: fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+			, signalTime_(0)
+		{
+			if (fd_ < 0)
+			{
+				throw cet::exception("WakeupEvent") << "Cannot create eventfd: " << strerror(errno);
+			}
+		}
+
+		/**
+		 * \brief WakeupEvent Destructor
+		 */
+		~WakeupEvent() { close(fd_); }
+
+		WakeupEvent(WakeupEvent const&) = delete;
+		WakeupEvent& operator=(WakeupEvent const&) = delete;
+
+		/**
+		 * \brief Get the file descriptor, to add to a poll set
+		 * \return The eventfd, which is readable once signalled
+		 */
+		int fd() const { return fd_; }
+
+		/**
+		 * \brief Wake everything waiting on the event. Safe to call from any thread, any number of times
+		 */
+		void signal()
+		{
+			uint64_t expected = 0;
+			signalTime_.compare_exchange_strong(expected, now_());
+			eventfd_write(fd_, 1);
+		}
+
+		/**
+		 * \brief Whether signal() has been called since the last clear()
+		 * \return True if the event is signalled
+		 */
+		bool signalled() const { return signalTime_.load() != 0; }
+
+		/**
+		 * \brief Reset the event, at start or resume
+		 */
+		void clear()
+		{
+			// Reset the flag before draining, so that a signal() in between is
+			// not lost: it sets the flag again, and its write is put back below
+			// if the drain took it
+			signalTime_.exchange(0);
+			eventfd_t value;
+			eventfd_read(fd_, &value);
+			if (signalled()) eventfd_write(fd_, 1);
+		}
+
+		/**
+		 * \brief Get how long ago the event was first signalled
+		 * \return Time since the first signal() after the last clear(), or zero if not signalled
+		 */
+		std::chrono::nanoseconds sinceSignal() const
+		{
+			uint64_t signalTime = signalTime_.load();
+			return std::chrono::nanoseconds(signalTime != 0 ? now_() - signalTime : 0);
+		}
+
+		/**
+		 * \brief Sleep until the event is signalled
+		 * \param timeout Longest to sleep
+		 * \return Whether the event is signalled
+		 */
+		bool wait(std::chrono::microseconds timeout) const
+		{
+			waitFor(-1, 0, timeout);
+			return signalled();
+		}
+
+		/**
+		 * \brief Sleep until a file descriptor is ready or the event is signalled
+		 * \param fd File descriptor to wait on. If negative, only the event is waited on
+		 * \param events poll events to wait for on fd
+		 * \param timeout Longest to sleep
+		 * \return Whether fd is ready
+		 */
+		bool waitFor(int fd, short events, std::chrono::microseconds timeout) const
+		{
+			struct pollfd ufds[2];
+			ufds[0].fd = fd_;
+			ufds[0].events = POLLIN;
+			ufds[0].revents = 0;
+			ufds[1].fd = fd;
+			ufds[1].events = events;
+			ufds[1].revents = 0;
+
+			struct timespec ts;
+			ts.tv_sec = timeout.count() / 1000000;
+			ts.tv_nsec = (timeout.count() % 1000000) * 1000;
+			ppoll(ufds, 2, &ts, nullptr);
+			return fd >= 0 && (ufds[1].revents & events) != 0;
+		}
+
+	private:
+		static uint64_t now_()
+		{
+			// Never 0, which means "not signalled"
+			auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+			return now > 0 ? uint64_t(now) : 1;
+		}
+
+		int fd_;
+		std::atomic<uint64_t> signalTime_; ///< When signal() was first called, from steady_clock in ns, or 0
+	};
+}
+
+#endif /* artdaq_demo_Generators_WakeupEvent_hh */
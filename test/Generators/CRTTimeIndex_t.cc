@@ -0,0 +1,127 @@
+#define BOOST_TEST_MODULE ( CRTTimeIndex_t )
+#include <boost/test/auto_unit_test.hpp>
+
+#include "artdaq-demo/Generators/CRTInterface/CRTTimeIndex.hh"
+#include "artdaq-demo/Generators/CRTInterface/CRTdecode.hh"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+
+namespace
+{
+	std::string temp_name()
+	{
+		char path[] = "/tmp/CRTTimeIndex_tXXXXXX";
+		int fd = mkstemp(path);
+		BOOST_REQUIRE(fd >= 0);
+		close(fd);
+		return path;
+	}
+
+	// Entries every 100 bytes, with times 1000, 2000 and 3000 ns
+	std::string write_index()
+	{
+		std::string name = temp_name();
+		CRT::TimeIndexWriter writer;
+		BOOST_REQUIRE(writer.open(name));
+		BOOST_REQUIRE(writer.is_open());
+		writer.add(0, 1000, 0x10001);
+		writer.add(100, 2000, 0x10002);
+		writer.add(200, 3000, 0x10003);
+		writer.close();
+		BOOST_REQUIRE(!writer.is_open());
+		return name;
+	}
+
+	uint64_t offset_for(CRT::TimeIndexReader const& reader, uint64_t time_ns)
+	{
+		CRT::index_entry entry;
+		BOOST_REQUIRE(reader.find(time_ns, entry));
+		return entry.offset;
+	}
+}
+
+BOOST_AUTO_TEST_SUITE(CRTTimeIndex_t)
+
+BOOST_AUTO_TEST_CASE(RoundTrip)
+{
+	std::string name = write_index();
+	CRT::TimeIndexReader reader(name);
+	unlink(name.c_str());
+	BOOST_REQUIRE_EQUAL(reader.size(), 3u);
+
+	CRT::index_entry entry;
+	BOOST_REQUIRE(reader.find(2500, entry));
+	BOOST_REQUIRE_EQUAL(entry.offset, 100u);
+	BOOST_REQUIRE_EQUAL(entry.maxtime_ns, 2000u);
+	BOOST_REQUIRE_EQUAL(entry.unixtime, 0x10002u);
+}
+
+BOOST_AUTO_TEST_CASE(Lookup)
+{
+	std::string name = write_index();
+	CRT::TimeIndexReader reader(name);
+	unlink(name.c_str());
+
+	// Before the first entry, start at the beginning
+	BOOST_REQUIRE_EQUAL(offset_for(reader, 0), 0u);
+	BOOST_REQUIRE_EQUAL(offset_for(reader, 999), 0u);
+
+	// At a boundary, packets up to maxtime_ns may lie before the entry, so
+	// start one entry earlier
+	BOOST_REQUIRE_EQUAL(offset_for(reader, 1000), 0u);
+	BOOST_REQUIRE_EQUAL(offset_for(reader, 1001), 0u);
+	BOOST_REQUIRE_EQUAL(offset_for(reader, 2000), 0u);
+	BOOST_REQUIRE_EQUAL(offset_for(reader, 2001), 100u);
+	BOOST_REQUIRE_EQUAL(offset_for(reader, 3000), 100u);
+
+	// After the last entry, start at the last entry
+	BOOST_REQUIRE_EQUAL(offset_for(reader, 3001), 200u);
+	BOOST_REQUIRE_EQUAL(offset_for(reader, uint64_t(-1)), 200u);
+}
+
+BOOST_AUTO_TEST_CASE(Empty)
+{
+	CRT::index_entry entry;
+	BOOST_REQUIRE(!CRT::TimeIndexReader("/nonexistent/index.idx").find(0, entry));
+
+	std::string name = temp_name();
+	CRT::TimeIndexReader reader(name);
+	unlink(name.c_str());
+	BOOST_REQUIRE_EQUAL(reader.size(), 0u);
+	BOOST_REQUIRE(!reader.find(0, entry));
+}
+
+BOOST_AUTO_TEST_CASE(SeekToTime)
+{
+	std::string index = write_index();
+	std::string data = temp_name();
+	int fd = open(data.c_str(), O_RDWR);
+	BOOST_REQUIRE(fd >= 0);
+	BOOST_REQUIRE_EQUAL(write(fd, std::string(300, 'x').data(), 300), 300);
+
+	CRT::unix_time_hi = CRT::unix_time_lo = 0;
+	BOOST_REQUIRE(CRT::seek_to_time(fd, index, 2500));
+	BOOST_REQUIRE_EQUAL(lseek(fd, 0, SEEK_CUR), 100);
+	BOOST_REQUIRE_EQUAL(CRT::unix_time_hi, 1);
+	BOOST_REQUIRE_EQUAL(CRT::unix_time_lo, 2);
+
+	// An index that can't be read leaves everything alone
+	BOOST_REQUIRE(!CRT::seek_to_time(fd, "/nonexistent/index.idx", 0));
+	BOOST_REQUIRE_EQUAL(lseek(fd, 0, SEEK_CUR), 100);
+	BOOST_REQUIRE_EQUAL(CRT::unix_time_lo, 2);
+
+	close(fd);
+	unlink(data.c_str());
+	unlink(index.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(FileName)
+{
+	BOOST_REQUIRE_EQUAL(CRT::index_file_name("/idx", "/data/run_0001.wr"), "/idx/run_0001.idx");
+	BOOST_REQUIRE_EQUAL(CRT::index_file_name("/idx", "run_0001"), "/idx/run_0001.idx");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
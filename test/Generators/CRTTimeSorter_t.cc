@@ -0,0 +1,98 @@
+#define BOOST_TEST_MODULE ( CRTTimeSorter_t )
+#include <boost/test/auto_unit_test.hpp>
+
+#include "artdaq-demo/Generators/CRTInterface/CRTTimeSorter.hh"
+
+#include <string.h>
+#include <vector>
+
+namespace
+{
+	// A module packet header with no hits; enough for the sorter
+	std::vector<char> make_packet(uint16_t module, uint32_t timeunix, uint32_t time16ns)
+	{
+		std::vector<char> packet(12);
+		packet[0] = 'M';
+		memcpy(&packet[2], &module, sizeof module);
+		memcpy(&packet[4], &timeunix, sizeof timeunix);
+		memcpy(&packet[8], &time16ns, sizeof time16ns);
+		return packet;
+	}
+
+	uint16_t module_of(std::vector<char> const* packet)
+	{
+		uint16_t module;
+		memcpy(&module, &(*packet)[2], sizeof module);
+		return module;
+	}
+}
+
+BOOST_AUTO_TEST_SUITE(CRTTimeSorter_t)
+
+BOOST_AUTO_TEST_CASE(Watermark)
+{
+	// 1 us budget = 50 ticks
+	CRT::TimeSorter sorter(1000);
+
+	auto p1 = make_packet(1, 100, 100);
+	auto p2 = make_packet(2, 100, 80);
+	auto p3 = make_packet(3, 100, 140);
+	BOOST_REQUIRE(sorter.push(p1.data(), p1.size()));
+	BOOST_REQUIRE(sorter.push(p2.data(), p2.size()));
+
+	// Latest is tick 100, so nothing is below the watermark yet
+	BOOST_REQUIRE(sorter.ready() == nullptr);
+	BOOST_REQUIRE_EQUAL(sorter.size(), 2u);
+
+	// Latest is now tick 140; tick 80 may go, tick 100 not quite
+	BOOST_REQUIRE(sorter.push(p3.data(), p3.size()));
+	BOOST_REQUIRE(sorter.ready() != nullptr);
+	BOOST_REQUIRE_EQUAL(module_of(sorter.ready()), 2);
+	sorter.pop();
+	BOOST_REQUIRE(sorter.ready() == nullptr);
+
+	// Forcing releases the rest, in order
+	BOOST_REQUIRE_EQUAL(module_of(sorter.ready(true)), 1);
+	sorter.pop();
+	BOOST_REQUIRE_EQUAL(module_of(sorter.ready(true)), 3);
+	sorter.pop();
+	BOOST_REQUIRE(sorter.ready(true) == nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(Late)
+{
+	CRT::TimeSorter sorter(1000);
+
+	auto p1 = make_packet(1, 100, 100);
+	auto p2 = make_packet(2, 100, 50);
+	BOOST_REQUIRE(sorter.push(p1.data(), p1.size()));
+	sorter.pop();
+
+	BOOST_REQUIRE(!sorter.push(p2.data(), p2.size()));
+	BOOST_REQUIRE_EQUAL(sorter.late(), 1u);
+	BOOST_REQUIRE_EQUAL(sorter.size(), 0u);
+
+	// After clear(), old time stamps don't make anything late
+	sorter.clear();
+	BOOST_REQUIRE(sorter.push(p2.data(), p2.size()));
+	BOOST_REQUIRE_EQUAL(sorter.late(), 1u);
+}
+
+BOOST_AUTO_TEST_CASE(CounterPastOneSecond)
+{
+	// The counter runs from the last sync pulse and can pass a second, but a
+	// packet from a later Unix second still sorts after it
+	auto slow = make_packet(1, 100, 75000000); // 1.5 s of ticks
+	auto next = make_packet(2, 101, 1000);
+	BOOST_REQUIRE_LT(CRT::TimeSorter::packet_time(slow.data()), CRT::TimeSorter::packet_time(next.data()));
+	BOOST_REQUIRE_EQUAL(CRT::TimeSorter::packet_time(slow.data()), 100999999999ull);
+
+	CRT::TimeSorter sorter(1000);
+	BOOST_REQUIRE(sorter.push(next.data(), next.size()));
+	BOOST_REQUIRE(sorter.push(slow.data(), slow.size()));
+	BOOST_REQUIRE_EQUAL(module_of(sorter.ready()), 1);
+	sorter.pop();
+	BOOST_REQUIRE_EQUAL(module_of(sorter.ready(true)), 2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,119 @@
+#define BOOST_TEST_MODULE ( JsonIndex_t )
+#include <boost/test/auto_unit_test.hpp>
+
+#include "artdaq-demo/Generators/UDPInterface/JsonIndex.hh"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace
+{
+	// Lay the text out as UDPReceiver does, and index it
+	std::vector<uint8_t> indexed(std::string const& text, size_t maxEntries, size_t& indexBytes)
+	{
+		size_t start = demo::JsonIndex::offset(text.size());
+		std::vector<uint8_t> payload(start + demo::JsonIndex::bytes(maxEntries), 0);
+		memcpy(payload.data(), text.c_str(), text.size());
+		indexBytes = demo::JsonIndex::build(text.c_str(), text.size(), payload.data() + start, maxEntries);
+		payload.resize(start + indexBytes);
+		return payload;
+	}
+
+	std::string key(demo::JsonIndex const& index, size_t entry)
+	{
+		demo::JsonIndex::Entry e = index.entry(entry);
+		return std::string(index.text() + e.keyOffset, e.keyLength);
+	}
+
+	std::string value(demo::JsonIndex const& index, size_t entry)
+	{
+		demo::JsonIndex::Entry e = index.entry(entry);
+		return std::string(index.text() + e.valueOffset, e.valueLength);
+	}
+}
+
+BOOST_AUTO_TEST_SUITE(JsonIndex_t)
+
+BOOST_AUTO_TEST_CASE(Members)
+{
+	std::string text = " {\"run\": 12, \"rate\": -2.5e3, \"name\": \"a\\\"b\", \"ok\": true, \"none\": null,"
+	                   " \"adc\": {\"ch\": [1, 2, {\"gain\": 0.125}], \"big\": 12345678901234567890}} \n";
+	size_t indexBytes = 0;
+	std::vector<uint8_t> payload = indexed(text, 16, indexBytes);
+	BOOST_REQUIRE(indexBytes > 0);
+
+	demo::JsonIndex index(payload.data(), payload.size());
+	BOOST_REQUIRE(index.valid());
+	BOOST_REQUIRE(!index.truncated());
+	BOOST_REQUIRE_EQUAL(index.size(), 9u);
+	BOOST_REQUIRE_EQUAL(std::string(index.text()), text);
+
+	BOOST_REQUIRE_EQUAL(index.find("run"), 0);
+	BOOST_REQUIRE(index.entry(0).type == demo::JsonIndex::ValueType::Number);
+	BOOST_REQUIRE_EQUAL(index.entry(0).number, 12);
+	BOOST_REQUIRE_EQUAL(index.entry(1).number, -2500);
+	BOOST_REQUIRE_EQUAL(value(index, 1), "-2.5e3");
+
+	BOOST_REQUIRE(index.entry(2).type == demo::JsonIndex::ValueType::String);
+	BOOST_REQUIRE_EQUAL(value(index, 2), "a\\\"b");
+	BOOST_REQUIRE(index.entry(3).type == demo::JsonIndex::ValueType::True);
+	BOOST_REQUIRE(index.entry(4).type == demo::JsonIndex::ValueType::Null);
+
+	int adc = index.find("adc");
+	BOOST_REQUIRE_EQUAL(adc, 5);
+	BOOST_REQUIRE(index.entry(adc).type == demo::JsonIndex::ValueType::Object);
+	BOOST_REQUIRE_EQUAL(value(index, adc).front(), '{');
+	BOOST_REQUIRE_EQUAL(value(index, adc).back(), '}');
+
+	// Members of an object inside an array are filed under the array's entry
+	int ch = index.find("ch", adc);
+	BOOST_REQUIRE_EQUAL(ch, 6);
+	BOOST_REQUIRE_EQUAL(value(index, ch), "[1, 2, {\"gain\": 0.125}]");
+	int gain = index.find("gain", ch);
+	BOOST_REQUIRE_EQUAL(gain, 7);
+	BOOST_REQUIRE_EQUAL(index.entry(gain).number, 0.125);
+	BOOST_REQUIRE_EQUAL(index.find("gain"), -1);
+
+	// Too many digits for the fast path
+	BOOST_REQUIRE_EQUAL(key(index, 8), "big");
+	BOOST_REQUIRE_EQUAL(index.entry(8).number, 12345678901234567890.0);
+}
+
+BOOST_AUTO_TEST_CASE(Truncated)
+{
+	std::string text = "[{\"a\": 1, \"b\": {\"c\": 2}}, {\"d\": 3}]";
+	size_t indexBytes = 0;
+	std::vector<uint8_t> payload = indexed(text, 2, indexBytes);
+	BOOST_REQUIRE_EQUAL(indexBytes, demo::JsonIndex::bytes(2));
+
+	demo::JsonIndex index(payload.data(), payload.size());
+	BOOST_REQUIRE(index.valid());
+	BOOST_REQUIRE(index.truncated());
+	BOOST_REQUIRE_EQUAL(index.size(), 2u);
+	BOOST_REQUIRE_EQUAL(key(index, 0), "a");
+	BOOST_REQUIRE_EQUAL(key(index, 1), "b");
+	BOOST_REQUIRE_EQUAL(value(index, 1), "{\"c\": 2}");
+	BOOST_REQUIRE_EQUAL(index.entry(1).parent, demo::JsonIndex::noParent);
+}
+
+BOOST_AUTO_TEST_CASE(NotJson)
+{
+	const char* texts[] = {"", "42", "{\"a\": 1", "{\"a\" 1}", "{\"a\": 01}", "[1, 2,]", "{\"a\": tru}",
+	                       "[1.]", "[1] x", "{\"a\": \"unterminated}", "[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[["
+	                                                                     "[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]"
+	                                                                     "]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]"};
+	for (auto text : texts)
+	{
+		size_t indexBytes = 1;
+		indexed(text, 8, indexBytes);
+		BOOST_CHECK_MESSAGE(indexBytes == 0, text);
+	}
+
+	// Plain text after the NUL is not mistaken for an index
+	std::vector<uint8_t> payload(64, 'x');
+	payload[3] = 0;
+	BOOST_REQUIRE(!demo::JsonIndex(payload.data(), payload.size()).valid());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
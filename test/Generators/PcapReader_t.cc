@@ -0,0 +1,239 @@
+#define BOOST_TEST_MODULE ( PcapReader_t )
+#include <boost/test/auto_unit_test.hpp>
+
+#include "artdaq-demo/Generators/UDPInterface/PcapReader.hh"
+
+#include <arpa/inet.h>
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+namespace
+{
+	typedef std::vector<uint8_t> Bytes;
+
+	// Append a value in the given byte order
+	void put(Bytes& out, uint64_t value, size_t size, bool bigEndian)
+	{
+		for (size_t ii = 0; ii < size; ++ii)
+		{
+			size_t shift = 8 * (bigEndian ? size - 1 - ii : ii);
+			out.push_back(uint8_t(value >> shift));
+		}
+	}
+
+	// An IPv4 UDP datagram from 10.0.0.<host>, or a TCP segment if udp is false
+	Bytes ipv4(uint8_t host, uint16_t sourcePort, uint16_t destinationPort, std::string const& payload, bool udp = true, bool fragment = false)
+	{
+		Bytes out = {0x45, 0};
+		put(out, 20 + 8 + payload.size(), 2, true);
+		put(out, 0, 2, true);
+		put(out, fragment ? 0x2000 : 0x4000, 2, true);
+		out.push_back(64);
+		out.push_back(udp ? 17 : 6);
+		put(out, 0, 2, true);
+		Bytes addresses = {10, 0, 0, host, 10, 0, 0, 1};
+		out.insert(out.end(), addresses.begin(), addresses.end());
+		put(out, sourcePort, 2, true);
+		put(out, destinationPort, 2, true);
+		put(out, 8 + payload.size(), 2, true);
+		put(out, 0, 2, true);
+		out.insert(out.end(), payload.begin(), payload.end());
+		return out;
+	}
+
+	Bytes ethernet(Bytes const& packet, bool vlan = false)
+	{
+		Bytes out(12, 0xEE);
+		if (vlan)
+		{
+			put(out, 0x8100, 2, true);
+			put(out, 42, 2, true);
+		}
+		put(out, 0x0800, 2, true);
+		out.insert(out.end(), packet.begin(), packet.end());
+		return out;
+	}
+
+	// Classic pcap: file header, then a record per frame
+	Bytes pcap(bool bigEndian, bool nano, uint16_t linkType, std::vector<Bytes> const& frames, uint32_t firstSecond)
+	{
+		Bytes out;
+		put(out, nano ? 0xA1B23C4D : 0xA1B2C3D4, 4, bigEndian);
+		put(out, 2, 2, bigEndian);
+		put(out, 4, 2, bigEndian);
+		put(out, 0, 4, bigEndian);
+		put(out, 0, 4, bigEndian);
+		put(out, 65535, 4, bigEndian);
+		put(out, linkType, 4, bigEndian);
+		for (size_t ii = 0; ii < frames.size(); ++ii)
+		{
+			put(out, firstSecond + ii, 4, bigEndian);
+			put(out, 500, 4, bigEndian);
+			put(out, frames[ii].size(), 4, bigEndian);
+			put(out, frames[ii].size(), 4, bigEndian);
+			out.insert(out.end(), frames[ii].begin(), frames[ii].end());
+		}
+		return out;
+	}
+
+	void block(Bytes& out, uint32_t type, Bytes body)
+	{
+		while (body.size() % 4 != 0) body.push_back(0);
+		put(out, type, 4, false);
+		put(out, 12 + body.size(), 4, false);
+		out.insert(out.end(), body.begin(), body.end());
+		put(out, 12 + body.size(), 4, false);
+	}
+
+	Bytes interfaceBlock(uint16_t linkType, int resolution)
+	{
+		Bytes body;
+		put(body, linkType, 2, false);
+		put(body, 0, 2, false);
+		put(body, 0, 4, false);
+		if (resolution >= 0)
+		{
+			put(body, 9, 2, false);
+			put(body, 1, 2, false);
+			put(body, resolution, 4, false);
+		}
+		put(body, 0, 4, false);
+		return body;
+	}
+
+	Bytes packetBlock(uint32_t interface, uint64_t ticks, Bytes const& frame, size_t original)
+	{
+		Bytes body;
+		put(body, interface, 4, false);
+		put(body, ticks >> 32, 4, false);
+		put(body, ticks & 0xFFFFFFFF, 4, false);
+		put(body, frame.size(), 4, false);
+		put(body, original, 4, false);
+		body.insert(body.end(), frame.begin(), frame.end());
+		return body;
+	}
+
+	std::string writeFile(Bytes const& contents)
+	{
+		char path[] = "/tmp/PcapReader_tXXXXXX";
+		int fd = mkstemp(path);
+		BOOST_REQUIRE(fd >= 0);
+		BOOST_REQUIRE(write(fd, contents.data(), contents.size()) == ssize_t(contents.size()));
+		close(fd);
+		return path;
+	}
+
+	std::string payload(demo::PcapReader::Datagram const& datagram)
+	{
+		return std::string(reinterpret_cast<const char*>(datagram.data), datagram.size);
+	}
+}
+
+BOOST_AUTO_TEST_SUITE(PcapReader_t)
+
+BOOST_AUTO_TEST_CASE(ClassicEthernet)
+{
+	std::string path = writeFile(pcap(false, false, 1, {ethernet(ipv4(2, 5000, 3001, "first")),
+	                                                    ethernet(ipv4(2, 5000, 3001, "tcp", false)),
+	                                                    ethernet(ipv4(2, 5000, 3001, "fragment", true, true)),
+	                                                    ethernet(ipv4(3, 6000, 3002, "second"), true)},
+	                                  1000));
+	demo::PcapReader reader;
+	BOOST_REQUIRE(reader.open(path));
+	unlink(path.c_str());
+
+	demo::PcapReader::Datagram datagram;
+	BOOST_REQUIRE(reader.next(datagram));
+	BOOST_REQUIRE_EQUAL(payload(datagram), "first");
+	BOOST_REQUIRE_EQUAL(datagram.sourcePort, 5000);
+	BOOST_REQUIRE_EQUAL(datagram.destinationPort, 3001);
+	BOOST_REQUIRE_EQUAL(ntohl(datagram.sourceAddress), 0x0A000002u);
+	BOOST_REQUIRE_EQUAL(datagram.time, 1000000500000ull);
+
+	// The TCP segment and the fragment are skipped
+	BOOST_REQUIRE(reader.next(datagram));
+	BOOST_REQUIRE_EQUAL(payload(datagram), "second");
+	BOOST_REQUIRE_EQUAL(datagram.destinationPort, 3002);
+	BOOST_REQUIRE_EQUAL(datagram.time, 1003000500000ull);
+
+	BOOST_REQUIRE(!reader.next(datagram));
+	BOOST_REQUIRE(reader.error().empty());
+	BOOST_REQUIRE_EQUAL(reader.skipped(), 2u);
+}
+
+BOOST_AUTO_TEST_CASE(ClassicSwappedNanoseconds)
+{
+	std::string path = writeFile(pcap(true, true, 101, {ipv4(4, 1234, 3001, "raw")}, 7));
+	demo::PcapReader reader;
+	BOOST_REQUIRE(reader.open(path));
+	unlink(path.c_str());
+
+	demo::PcapReader::Datagram datagram;
+	BOOST_REQUIRE(reader.next(datagram));
+	BOOST_REQUIRE_EQUAL(payload(datagram), "raw");
+	BOOST_REQUIRE_EQUAL(datagram.sourcePort, 1234);
+	BOOST_REQUIRE_EQUAL(datagram.time, 7000000500ull);
+	BOOST_REQUIRE(!reader.next(datagram));
+}
+
+BOOST_AUTO_TEST_CASE(Pcapng)
+{
+	Bytes file;
+	Bytes section;
+	put(section, 0x1A2B3C4D, 4, false);
+	put(section, 1, 2, false);
+	put(section, 0, 2, false);
+	put(section, uint64_t(-1), 8, false);
+	block(file, 0x0A0D0D0A, section);
+
+	// Linux cooked capture with nanosecond timestamps, then Ethernet with the
+	// default microseconds
+	Bytes cooked(14, 0);
+	put(cooked, 0x0800, 2, true);
+	Bytes udp = ipv4(5, 7000, 3001, "cooked");
+	cooked.insert(cooked.end(), udp.begin(), udp.end());
+	block(file, 1, interfaceBlock(113, 9));
+	block(file, 1, interfaceBlock(1, -1));
+	block(file, 6, packetBlock(0, 1234567890123ull, cooked, cooked.size()));
+	block(file, 5, Bytes(16, 0)); // Interface statistics
+	Bytes cut = ethernet(ipv4(6, 7001, 3001, "cut short"));
+	block(file, 6, packetBlock(1, 1, Bytes(cut.begin(), cut.begin() + 30), cut.size()));
+	Bytes tagged = ethernet(ipv4(6, 7001, 3001, "ethernet"), true);
+	block(file, 6, packetBlock(1, 2000001, tagged, tagged.size()));
+
+	std::string path = writeFile(file);
+	demo::PcapReader reader;
+	BOOST_REQUIRE(reader.open(path));
+	unlink(path.c_str());
+
+	demo::PcapReader::Datagram datagram;
+	BOOST_REQUIRE(reader.next(datagram));
+	BOOST_REQUIRE_EQUAL(payload(datagram), "cooked");
+	BOOST_REQUIRE_EQUAL(datagram.sourcePort, 7000);
+	BOOST_REQUIRE_EQUAL(datagram.time, 1234567890123ull);
+
+	BOOST_REQUIRE(reader.next(datagram));
+	BOOST_REQUIRE_EQUAL(payload(datagram), "ethernet");
+	BOOST_REQUIRE_EQUAL(datagram.time, 2000001000ull);
+
+	BOOST_REQUIRE(!reader.next(datagram));
+	BOOST_REQUIRE(reader.error().empty());
+	BOOST_REQUIRE_EQUAL(reader.skipped(), 1u);
+}
+
+BOOST_AUTO_TEST_CASE(NotACapture)
+{
+	std::string path = writeFile(Bytes(64, 'x'));
+	demo::PcapReader reader;
+	BOOST_REQUIRE(!reader.open(path));
+	BOOST_REQUIRE(!reader.error().empty());
+	unlink(path.c_str());
+
+	BOOST_REQUIRE(!reader.open("/nonexistent/capture.pcap"));
+	BOOST_REQUIRE(!reader.error().empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,199 @@
+#define BOOST_TEST_MODULE ( ReorderWindow_t )
+#include <boost/test/auto_unit_test.hpp>
+
+#include "artdaq-demo/Generators/UDPInterface/ReorderWindow.hh"
+
+#include <vector>
+
+namespace
+{
+	typedef demo::ReorderWindow::Result Result;
+	const uint8_t Start = demo::ReorderWindow::BurstStart;
+	const uint8_t End = demo::ReorderWindow::BurstEnd;
+
+	// Use the sequence number as the handle, to make the checks easy to read
+	Result put(demo::ReorderWindow& window, uint32_t sequence, uint8_t flags)
+	{
+		return window.insert(sequence, sequence, flags);
+	}
+}
+
+BOOST_AUTO_TEST_SUITE(ReorderWindow_t)
+
+BOOST_AUTO_TEST_CASE(InOrder)
+{
+	demo::ReorderWindow window(8, 0xFF);
+
+	BOOST_REQUIRE(put(window, 10, Start | End) == Result::Inserted);
+	BOOST_REQUIRE(window.nextBurst());
+	BOOST_REQUIRE(window.burst() == std::vector<uint32_t>({10}));
+	window.releaseBurst();
+
+	BOOST_REQUIRE(!window.holding());
+
+	// A burst that has not ended holds its packets, with nothing waiting
+	BOOST_REQUIRE(put(window, 11, Start) == Result::Inserted);
+	BOOST_REQUIRE(!window.nextBurst());
+	BOOST_REQUIRE(put(window, 12, 0) == Result::Inserted);
+	BOOST_REQUIRE(!window.nextBurst());
+	BOOST_REQUIRE(window.empty());
+	BOOST_REQUIRE(window.holding());
+	BOOST_REQUIRE(put(window, 13, End) == Result::Inserted);
+	BOOST_REQUIRE(window.nextBurst());
+	BOOST_REQUIRE(!window.holding());
+	BOOST_REQUIRE(window.burst() == std::vector<uint32_t>({11, 12, 13}));
+	window.releaseBurst();
+
+	BOOST_REQUIRE(window.released() == std::vector<uint32_t>({10, 11, 12, 13}));
+	BOOST_REQUIRE_EQUAL(window.lost(), 0u);
+	BOOST_REQUIRE_EQUAL(window.discarded(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(Reordered)
+{
+	demo::ReorderWindow window(8, 0xFF);
+
+	// Across the wrap of the 8-bit sequence number, too
+	BOOST_REQUIRE(put(window, 254, Start) == Result::Inserted);
+	BOOST_REQUIRE(!window.nextBurst());
+	BOOST_REQUIRE(put(window, 1, End) == Result::Inserted);
+	BOOST_REQUIRE(put(window, 0, 0) == Result::Inserted);
+	BOOST_REQUIRE(put(window, 0, 0) == Result::Duplicate);
+	BOOST_REQUIRE(!window.nextBurst());
+	BOOST_REQUIRE(put(window, 255, 0) == Result::Inserted);
+	BOOST_REQUIRE(window.nextBurst());
+	BOOST_REQUIRE(window.burst() == std::vector<uint32_t>({254, 255, 0, 1}));
+	window.releaseBurst();
+
+	BOOST_REQUIRE(put(window, 255, 0) == Result::Late);
+	BOOST_REQUIRE(window.empty());
+	BOOST_REQUIRE_EQUAL(window.head(), 2u);
+	BOOST_REQUIRE_EQUAL(window.duplicates(), 1u);
+	BOOST_REQUIRE_EQUAL(window.late(), 1u);
+}
+
+BOOST_AUTO_TEST_CASE(Gap)
+{
+	demo::ReorderWindow window(8, 0xFF);
+
+	// 2 never arrives, so the burst 1-3 is broken, but 4-5 is fine
+	BOOST_REQUIRE(put(window, 1, Start) == Result::Inserted);
+	BOOST_REQUIRE(put(window, 3, End) == Result::Inserted);
+	BOOST_REQUIRE(put(window, 4, Start) == Result::Inserted);
+	BOOST_REQUIRE(put(window, 5, End) == Result::Inserted);
+	BOOST_REQUIRE(!window.nextBurst());
+	BOOST_REQUIRE(!window.empty());
+
+	window.skipGap();
+	BOOST_REQUIRE(window.nextBurst());
+	BOOST_REQUIRE(window.burst() == std::vector<uint32_t>({4, 5}));
+	window.releaseBurst();
+
+	BOOST_REQUIRE_EQUAL(window.lost(), 1u);
+	BOOST_REQUIRE_EQUAL(window.discarded(), 2u);
+	BOOST_REQUIRE(window.released() == std::vector<uint32_t>({1, 3, 4, 5}));
+}
+
+BOOST_AUTO_TEST_CASE(Overflow)
+{
+	demo::ReorderWindow window(4, 0xFF);
+
+	BOOST_REQUIRE(put(window, 0, Start | End) == Result::Inserted);
+	BOOST_REQUIRE(window.nextBurst());
+	window.releaseBurst();
+
+	// 1 is missing; 2-4 fit, 5 does not until the gap is given up on
+	BOOST_REQUIRE(put(window, 2, Start) == Result::Inserted);
+	BOOST_REQUIRE(put(window, 3, 0) == Result::Inserted);
+	BOOST_REQUIRE(put(window, 4, 0) == Result::Inserted);
+	BOOST_REQUIRE(put(window, 5, End) == Result::Overflow);
+	window.skipGap();
+	BOOST_REQUIRE(!window.nextBurst());
+	BOOST_REQUIRE(put(window, 5, End) == Result::Inserted);
+	BOOST_REQUIRE(window.nextBurst());
+	BOOST_REQUIRE(window.burst() == std::vector<uint32_t>({2, 3, 4, 5}));
+}
+
+BOOST_AUTO_TEST_CASE(TooLong)
+{
+	demo::ReorderWindow window(8, 0xFF, 4);
+
+	// A burst of 10 is given up on once it reaches 4 packets without an end,
+	// so that it can't hold on to more. The rest of it is dropped as it comes.
+	for (uint32_t sequence = 0; sequence < 10; ++sequence)
+	{
+		BOOST_REQUIRE(put(window, sequence, sequence == 0 ? Start : sequence == 9 ? End : 0) == Result::Inserted);
+		BOOST_REQUIRE(!window.nextBurst());
+		BOOST_REQUIRE(window.burst().size() < 4);
+	}
+	BOOST_REQUIRE_EQUAL(window.abandoned(), 1u);
+	BOOST_REQUIRE_EQUAL(window.discarded(), 10u);
+	BOOST_REQUIRE_EQUAL(window.released().size(), 10u);
+	window.clearReleased();
+
+	// Bursts that fit still come out, up to exactly the limit
+	for (uint32_t sequence = 10; sequence < 14; ++sequence)
+	{
+		BOOST_REQUIRE(put(window, sequence, sequence == 10 ? Start : sequence == 13 ? End : 0) == Result::Inserted);
+	}
+	BOOST_REQUIRE(window.nextBurst());
+	BOOST_REQUIRE(window.burst() == std::vector<uint32_t>({10, 11, 12, 13}));
+	BOOST_REQUIRE(!window.abandonBurst());
+	window.releaseBurst();
+
+	// A burst in progress can be given up on from outside
+	BOOST_REQUIRE(put(window, 14, Start) == Result::Inserted);
+	BOOST_REQUIRE(!window.nextBurst());
+	BOOST_REQUIRE(window.abandonBurst());
+	BOOST_REQUIRE(window.burst().empty());
+	BOOST_REQUIRE(put(window, 15, End) == Result::Inserted);
+	BOOST_REQUIRE(!window.nextBurst());
+	BOOST_REQUIRE_EQUAL(window.abandoned(), 2u);
+	BOOST_REQUIRE(window.released() == std::vector<uint32_t>({10, 11, 12, 13, 14, 15}));
+}
+
+BOOST_AUTO_TEST_CASE(SenderRestart)
+{
+	demo::ReorderWindow window(4, 0xFF);
+
+	BOOST_REQUIRE(put(window, 100, Start | End) == Result::Inserted);
+	BOOST_REQUIRE(window.nextBurst());
+	window.releaseBurst();
+
+	// Sequence numbers far behind are late, until there are enough of them in
+	// a row to be believed
+	BOOST_REQUIRE(put(window, 0, Start | End) == Result::Late);
+	BOOST_REQUIRE(put(window, 1, Start | End) == Result::Late);
+	BOOST_REQUIRE(put(window, 2, Start | End) == Result::Late);
+	BOOST_REQUIRE(put(window, 3, Start | End) == Result::Inserted);
+	BOOST_REQUIRE(window.nextBurst());
+	BOOST_REQUIRE(window.burst() == std::vector<uint32_t>({3}));
+}
+
+BOOST_AUTO_TEST_CASE(WideSequence)
+{
+	// 32-bit sequence numbers, as in UDP protocol version 2
+	demo::ReorderWindow window(8, 0xFFFFFFFF);
+
+	BOOST_REQUIRE(window.insert(0xFFFFFFFE, 1, Start) == Result::Inserted);
+	BOOST_REQUIRE(window.insert(0, 3, 0) == Result::Inserted);
+	BOOST_REQUIRE(window.insert(1, 4, End) == Result::Inserted);
+	BOOST_REQUIRE(!window.nextBurst());
+	BOOST_REQUIRE(window.insert(0xFFFFFFFF, 2, 0) == Result::Inserted);
+	BOOST_REQUIRE(window.nextBurst());
+	BOOST_REQUIRE(window.burst() == std::vector<uint32_t>({1, 2, 3, 4}));
+	window.releaseBurst();
+
+	// 256 on from the last one is not mistaken for a repeat, as it would be
+	// with 8 bits
+	BOOST_REQUIRE(window.insert(2, 5, Start | End) == Result::Inserted);
+	BOOST_REQUIRE(window.nextBurst());
+	window.releaseBurst();
+	BOOST_REQUIRE(window.insert(258, 6, Start | End) == Result::Inserted);
+	BOOST_REQUIRE(window.nextBurst());
+	BOOST_REQUIRE(window.burst() == std::vector<uint32_t>({6}));
+	BOOST_REQUIRE_EQUAL(window.lost(), 255u);
+	BOOST_REQUIRE_EQUAL(window.late(), 0u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,318 @@
+//
+// udp_load_generator: sends UDP datagrams in the format UDPReceiver
+// expects, as fast as asked, for stress-testing the receive path. Each
+// datagram starts with a status byte (data type in the high nibble,
+// Read/First/Middle/Last in the low nibble) and an 8-bit sequence number,
+// or with --protocol 2, the 12-byte header of UDPInterface/UDPProtocol.hh,
+// with a 32-bit sequence number, burst ID and payload length.
+//
+// Drops, duplicates and reordering can be injected at fixed intervals, so
+// that a run is exactly repeatable. Works over loopback, so that sender and
+// receiver can run on one machine.
+//
+// Run 'udp_load_generator --help' for the options.
+//
+
+#include "artdaq-demo/Generators/UDPInterface/UDPProtocol.hh"
+
+#include <boost/program_options.hpp>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace bpo = boost::program_options;
+
+namespace
+{
+	enum ReturnCode : uint8_t { Read = 0, First = 1, Middle = 2, Last = 3 };
+	enum DataType : uint8_t { Raw = 0, JSON = 1, String = 2 };
+
+	struct Datagram
+	{
+		std::vector<uint8_t> bytes;
+	};
+
+	// Queues datagrams and sends them with sendmmsg, a batch at a time
+	class Sender
+	{
+	public:
+		Sender(int socket, struct sockaddr_in const& destination, size_t batch)
+			: socket_(socket)
+			, destination_(destination)
+			, batch_(std::max(batch, size_t(1)))
+			, sent_(0)
+			, errors_(0)
+		{
+			queue_.reserve(batch_);
+		}
+
+		void add(Datagram const& datagram)
+		{
+			queue_.push_back(datagram);
+			if (queue_.size() == batch_) flush();
+		}
+
+		void flush()
+		{
+			std::vector<struct mmsghdr> msgs(queue_.size());
+			std::vector<struct iovec> iovecs(queue_.size());
+			for (size_t ii = 0; ii < queue_.size(); ++ii)
+			{
+				iovecs[ii].iov_base = &queue_[ii].bytes[0];
+				iovecs[ii].iov_len = queue_[ii].bytes.size();
+				memset(&msgs[ii], 0, sizeof(msgs[ii]));
+				msgs[ii].msg_hdr.msg_name = &destination_;
+				msgs[ii].msg_hdr.msg_namelen = sizeof(destination_);
+				msgs[ii].msg_hdr.msg_iov = &iovecs[ii];
+				msgs[ii].msg_hdr.msg_iovlen = 1;
+			}
+
+			size_t done = 0;
+			while (done < msgs.size())
+			{
+				int count = sendmmsg(socket_, &msgs[done], msgs.size() - done, 0);
+				if (count < 0)
+				{
+					if (errno == EINTR) continue;
+					// Count the datagram as lost and carry on; it is the receiver
+					// that is being tested
+					++errors_;
+					++done;
+					continue;
+				}
+				done += count;
+				sent_ += count;
+			}
+			queue_.clear();
+		}
+
+		size_t queued() const { return queue_.size(); }
+		uint64_t sent() const { return sent_; }
+		uint64_t errors() const { return errors_; }
+
+	private:
+		int socket_;
+		struct sockaddr_in destination_;
+		size_t batch_;
+		std::vector<Datagram> queue_;
+		uint64_t sent_;
+		uint64_t errors_;
+	};
+
+	// Fill a datagram's payload with something recognizable for its type
+	void fill_payload(Datagram& datagram, size_t headerSize, DataType type, uint64_t burst, size_t packet)
+	{
+		uint8_t* payload = &datagram.bytes[headerSize];
+		size_t size = datagram.bytes.size() - headerSize;
+		if (type == JSON)
+		{
+			std::ostringstream json;
+			json << "{\"burst\":" << burst << ",\"packet\":" << packet << "}";
+			std::string text = json.str();
+			memset(payload, ' ', size);
+			memcpy(payload, text.data(), std::min(text.size(), size));
+		}
+		else if (type == String)
+		{
+			memset(payload, 'A' + (burst + packet) % 26, size);
+		}
+		else
+		{
+			for (size_t ii = 0; ii < size; ++ii) payload[ii] = static_cast<uint8_t>(burst + packet + ii);
+		}
+	}
+}
+
+int main(int argc, char* argv[]) try
+{
+	std::ostringstream descstr;
+	descstr << argv[0] << " <options>";
+
+	bpo::options_description desc = descstr.str();
+
+	desc.add_options()
+		("destination,d", bpo::value<std::string>()->default_value("127.0.0.1:6343"), "Where to send, as host:port")
+		("bursts,n", bpo::value<uint64_t>()->default_value(1000), "Number of bursts to send (0 for no limit)")
+		("burst-length,b", bpo::value<size_t>()->default_value(1), "Datagrams per burst. 1 sends single Read datagrams")
+		("size,s", bpo::value<size_t>()->default_value(1500), "Size of each datagram, including the header")
+		("type,t", bpo::value<std::string>()->default_value("raw"), "Data type: raw, json or string")
+		("rate,r", bpo::value<double>()->default_value(0), "Datagrams per second (0 for as fast as possible)")
+		("batch", bpo::value<size_t>()->default_value(32), "Datagrams per sendmmsg call")
+		("protocol", bpo::value<int>()->default_value(1), "Header format: 1 (8-bit sequence number) or 2 (32-bit sequence number, burst ID and length)")
+		("sequence", bpo::value<uint32_t>()->default_value(0), "First sequence number")
+		("drop-every", bpo::value<uint64_t>()->default_value(0), "Leave out every Nth datagram (0 for none)")
+		("duplicate-every", bpo::value<uint64_t>()->default_value(0), "Send every Nth datagram twice (0 for none)")
+		("reorder-every", bpo::value<uint64_t>()->default_value(0), "Send every Nth datagram after the one following it (0 for none)")
+		("help,h", "produce help message");
+
+	bpo::variables_map vm;
+
+	try
+	{
+		bpo::store(bpo::command_line_parser(argc, argv).options(desc).run(), vm);
+		bpo::notify(vm);
+	}
+	catch (bpo::error const& e)
+	{
+		std::cerr << "Exception from command line processing in " << argv[0]
+			<< ": " << e.what() << "\n";
+		return -1;
+	}
+
+	if (vm.count("help"))
+	{
+		std::cout << desc << std::endl;
+		return 1;
+	}
+
+	std::string destination = vm["destination"].as<std::string>();
+	size_t colon = destination.rfind(':');
+	struct sockaddr_in to;
+	memset(&to, 0, sizeof(to));
+	to.sin_family = AF_INET;
+	if (colon == std::string::npos || inet_aton(destination.substr(0, colon).c_str(), &to.sin_addr) == 0)
+	{
+		std::cerr << "Bad destination \"" << destination << "\"; expected a numeric address and port, like 127.0.0.1:6343\n";
+		return 2;
+	}
+	to.sin_port = htons(std::stoi(destination.substr(colon + 1)));
+
+	DataType type;
+	std::string typeName = vm["type"].as<std::string>();
+	if (typeName == "raw") type = Raw;
+	else if (typeName == "json") type = JSON;
+	else if (typeName == "string") type = String;
+	else
+	{
+		std::cerr << "Unknown data type \"" << typeName << "\"\n";
+		return 2;
+	}
+
+	int protocol = vm["protocol"].as<int>();
+	if (protocol != 1 && protocol != 2)
+	{
+		std::cerr << "Unknown protocol version " << protocol << "\n";
+		return 2;
+	}
+	size_t headerSize = protocol == 2 ? size_t(demo::UDPHeader::v2Size) : size_t(demo::UDPHeader::v1Size);
+
+	uint64_t bursts = vm["bursts"].as<uint64_t>();
+	size_t burstLength = std::max(vm["burst-length"].as<size_t>(), size_t(1));
+	size_t size = std::max(vm["size"].as<size_t>(), headerSize);
+	if (size > 65507)
+	{
+		std::cerr << "Datagrams can be at most 65507 bytes\n";
+		return 2;
+	}
+	double rate = vm["rate"].as<double>();
+	uint64_t dropEvery = vm["drop-every"].as<uint64_t>();
+	uint64_t duplicateEvery = vm["duplicate-every"].as<uint64_t>();
+	uint64_t reorderEvery = vm["reorder-every"].as<uint64_t>();
+	uint32_t sequence = vm["sequence"].as<uint32_t>();
+
+	int s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (s < 0)
+	{
+		perror("udp_load_generator: socket");
+		return 3;
+	}
+
+	Sender sender(s, to, vm["batch"].as<size_t>());
+	uint64_t generated = 0, dropped = 0, duplicated = 0, reordered = 0;
+	bool holding = false;
+	Datagram held;
+	Datagram datagram;
+	datagram.bytes.resize(size);
+
+	auto start = std::chrono::steady_clock::now();
+	for (uint64_t burst = 0; bursts == 0 || burst < bursts; ++burst)
+	{
+		for (size_t packet = 0; packet < burstLength; ++packet)
+		{
+			ReturnCode code = burstLength == 1 ? Read : packet == 0 ? First : packet + 1 == burstLength ? Last : Middle;
+			uint8_t status = static_cast<uint8_t>((type << 4) | code);
+			if (protocol == 2)
+			{
+				demo::UDPHeader header;
+				header.status = status;
+				header.version = 2;
+				header.payloadLength = static_cast<uint16_t>(size - headerSize);
+				header.sequence = sequence++;
+				header.burstID = static_cast<uint32_t>(burst);
+				header.writeV2(&datagram.bytes[0]);
+			}
+			else
+			{
+				datagram.bytes[0] = status;
+				datagram.bytes[1] = static_cast<uint8_t>(sequence++);
+			}
+			fill_payload(datagram, headerSize, type, burst, packet);
+			++generated;
+
+			// Faults are decided by position in the stream alone, so that a
+			// run can be repeated exactly
+			if (dropEvery > 0 && generated % dropEvery == 0)
+			{
+				++dropped;
+				continue;
+			}
+			if (reorderEvery > 0 && generated % reorderEvery == 0 && !holding)
+			{
+				held = datagram;
+				holding = true;
+				++reordered;
+				continue;
+			}
+
+			sender.add(datagram);
+			if (duplicateEvery > 0 && generated % duplicateEvery == 0)
+			{
+				sender.add(datagram);
+				++duplicated;
+			}
+			if (holding)
+			{
+				sender.add(held);
+				holding = false;
+			}
+
+			// Pace whole batches: send as soon as the schedule allows
+			if (rate > 0 && sender.queued() == 0)
+			{
+				auto due = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(sender.sent() / rate));
+				std::this_thread::sleep_until(due);
+			}
+		}
+	}
+	if (holding) sender.add(held);
+	sender.flush();
+
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "Sent " << sender.sent() << " datagrams (" << generated << " generated, " << dropped << " dropped, "
+		<< duplicated << " duplicated, " << reordered << " reordered, " << sender.errors() << " send errors) in "
+		<< elapsed << " s: " << sender.sent() / elapsed << " datagrams/s, "
+		<< sender.sent() * size * 8 / elapsed / 1e9 << " Gbit/s" << std::endl;
+
+	close(s);
+	return 0;
+}
+
+catch (std::exception& x)
+{
+	std::cerr << "Exception (type std::exception) caught in udp_load_generator: " << x.what() << "\n";
+	return 1;
+}